@@ -17,20 +17,32 @@
 # You should have received a copy of the GNU General Public License
 # along with CovidTracer. If not, see<https://www.gnu.org/licenses/>.
 
-import os, datetime, requests, tempfile, time
+import math, os, datetime, requests, tempfile, time
 
-from typing import Optional
+from typing import List, Optional, Tuple
 
 import gpxpy, gpxpy.gpx, pytz, swagger_client, wtforms
 
 from flask import Flask, jsonify, redirect, render_template, request, url_for
 from flask_sqlalchemy import SQLAlchemy
-from sqlalchemy import or_
+from sqlalchemy import false, inspect, or_, text
+from sqlalchemy.schema import CreateColumn
 from stravaio import StravaIO
 
 # Will finish an actvity if there was no movement for more one hour.
 INACTIVITY_DELAY = datetime.timedelta(hours=1)
 
+# Considers the bike idle between two locations of a track if it moved slower than 4 kph (see
+# `IDLE_THRESHOLD` in the firmware).
+IDLE_SPEED = 4 / 3.6 # m/s
+
+# The default time between the successive locations of a track message (the long tour profile
+# sends up to 6 locations every 6 minutes).
+TRACK_INTERVAL = datetime.timedelta(minutes=1)
+
+# The number of probes shown by the dashboard, per page.
+PROBES_PER_PAGE = 100
+
 app = Flask(__name__)
 app.config.from_object(os.environ['APP_SETTINGS'])
 
@@ -48,13 +60,61 @@ class Activity(db.Model):
 
     probes = db.relationship('Probe', backref='activity', order_by='Probe.id')
 
+    # The summaries computed by the tracker, if received. They are not affected by the saturation
+    # of the probes' accumulators, and override the totals computed from the probes.
+    trips = db.relationship('Trip', backref='activity', order_by='Trip.id')
+
+    # Running aggregates of the probes, updated by `add_probe()` so that the totals do not require
+    # loading every probe. `flask upgrade-db` adds them to existing databases, and initializes them
+    # on the activities recorded before.
+    started_at = db.Column(db.DateTime(), nullable=True)
+    ended_at = db.Column(db.DateTime(), nullable=True)
+    last_probe_id = db.Column(db.Integer, nullable=True)
+
+    probes_distance = db.Column(db.Integer, nullable=False, default=0, server_default='0')
+    probes_alt_gain = db.Column(db.Integer, nullable=False, default=0, server_default='0')
+    probes_moving_time = db.Column(db.Integer, nullable=False, default=0, server_default='0')
+
+    def add_probe(self, probe: 'Probe'):
+        """Associates the probe with the activity, and adds it to the aggregates, without loading
+        the other probes. The activity should have been flushed."""
+
+        probe.activity_id = self.id
+
+        started_at = probe.received_at - probe.moving_time_td
+        if self.started_at is None or started_at < self.started_at:
+            self.started_at = started_at
+
+        if self.ended_at is None or probe.received_at > self.ended_at:
+            self.ended_at = probe.received_at
+
+        self.last_probe_id = max(self.last_probe_id or 0, probe.id)
+
+        self.probes_distance = (self.probes_distance or 0) + (probe.dist or 0)
+        self.probes_alt_gain = (self.probes_alt_gain or 0) + (probe.alt_gain or 0)
+        self.probes_moving_time = (self.probes_moving_time or 0) + (probe.moving_time or 0)
+
+    def recompute(self):
+        """Recomputes the aggregates from all the probes, e.g. after a merge."""
+
+        self.started_at = self.ended_at = self.last_probe_id = None
+        self.probes_distance = self.probes_alt_gain = self.probes_moving_time = 0
+
+        for probe in Probe.query.filter(Probe.activity_id == self.id).order_by(Probe.id):
+            self.add_probe(probe)
+
     @property
     def started_at_local(self) -> datetime.datetime:
-        return self.probes[0].received_at_local - self.probes[0].moving_time_td
+        if self.trips:
+            return self.trips[0].started_at_local
+        return self.started_at.replace(tzinfo=pytz.UTC).astimezone(tz=timezone)
 
     @property
     def ended_at_local(self) -> datetime.datetime:
-        return self.probes[-1].received_at_local
+        ended_at_local = self.ended_at.replace(tzinfo=pytz.UTC).astimezone(tz=timezone)
+        if self.trips:
+            return max(self.trips[-1].ended_at_local, ended_at_local)
+        return ended_at_local
 
     @property
     def duration(self) -> datetime.timedelta:
@@ -63,16 +123,29 @@ class Activity(db.Model):
     @property
     def total_distance(self) -> int:
         """Total distance in meters."""
-        return sum(p.dist for p in self.probes)
+        if self.trips:
+            return sum(t.distance for t in self.trips)
+        return self.probes_distance
 
     @property
     def total_alt_gain(self) -> int:
         """Total altitude gain in meters."""
-        return sum(p.alt_gain for p in self.probes)
+        if self.trips:
+            return sum(t.alt_gain for t in self.trips)
+        return self.probes_alt_gain
 
     @property
     def total_moving_time(self) -> datetime.timedelta:
-        return sum((p.moving_time_td for p in self.probes), datetime.timedelta())
+        if self.trips:
+            return sum((t.moving_time_td for t in self.trips), datetime.timedelta())
+        return datetime.timedelta(seconds=self.probes_moving_time)
+
+    @property
+    def max_speed(self) -> Optional[float]:
+        """Highest speed between two probes in meters per second, if known."""
+        if self.trips:
+            return max(t.max_speed for t in self.trips)
+        return None
 
 class Probe(db.Model):
     __tablename__ = 'probes'
@@ -91,8 +164,95 @@ class Probe(db.Model):
     alt_gain = db.Column(db.Integer, nullable=True)     # m
     moving_time = db.Column(db.Integer, nullable=True)  # secs
 
+    # True if `dist`, `alt_gain` or `moving_time` exceeded the range of the message, and are
+    # lower bounds of the actual values.
+    saturated = db.Column(db.Boolean, nullable=False, default=False, server_default=false())
+
     activity_id = db.Column(db.Integer, db.ForeignKey('activities.id'), nullable=True)
 
+    LOCATION_VERSION = 1
+
+    @staticmethod
+    def decode(data: bytes, seq: int) -> 'Probe':
+        """Decodes a raw location message (see `radio_t::location_msg_t` in the firmware). Raises
+        a `ValueError` if its version is not supported."""
+
+        value = int.from_bytes(data, 'big')
+        offset = len(data) * 8
+
+        def read(n_bits: int) -> int:
+            nonlocal offset
+            offset -= n_bits
+            return (value >> offset) & ((1 << n_bits) - 1)
+
+        def read_scaled(exponent_bits: int, mantissa_bits: int) -> int:
+            exponent = read(exponent_bits)
+            return read(mantissa_bits) << exponent
+
+        version = read(3)
+        if version != Probe.LOCATION_VERSION:
+            raise ValueError(f'Unsupported location message version: {version}')
+
+        lat, lng, alt = read(24), read(24), read(11)
+        dist, alt_gain, moving_time = read_scaled(3, 8), read_scaled(3, 6), read_scaled(3, 8)
+        saturated = read(3) != 0
+
+        if lat == 0 and lng == 0:
+            # No valid location.
+            lat = lng = alt = 0
+        else:
+            lat = lat * 180 / (1 << 24) - 90
+            lng = lng * 360 / (1 << 24) - 180
+            alt = alt * 4 - 1000
+
+        return Probe(
+            seq=seq, lat=lat, lng=lng, alt=alt,
+            dist=dist, alt_gain=alt_gain, moving_time=moving_time, saturated=saturated,
+        )
+
+    @staticmethod
+    def decode_track(data: bytes) -> List[Tuple[float, float]]:
+        """Decodes the latitudes and longitudes of a packed track (see `radio_t::packed_track_t`
+        in the firmware), the most recent first."""
+
+        value = int.from_bytes(data, 'big')
+        offset = len(data) * 8
+
+        def read(n_bits: int) -> int:
+            nonlocal offset
+            offset -= n_bits
+            return (value >> offset) & ((1 << n_bits) - 1)
+
+        def read_signed(n_bits: int) -> int:
+            unsigned = read(n_bits)
+            return unsigned - (1 << n_bits) if unsigned >= 1 << (n_bits - 1) else unsigned
+
+        if value == 0:
+            return []
+
+        lat, lng = read(24), read(24)
+        n_deltas, scale = read(3), read(3)
+        read(2)
+
+        units = [(lat, lng)]
+        for _ in range(n_deltas):
+            lat += read_signed(4) << scale
+            lng += read_signed(4) << scale
+            units.append((lat, lng))
+
+        return [(lat * 180 / (1 << 24) - 90, lng * 360 / (1 << 24) - 180) for lat, lng in units]
+
+    @staticmethod
+    def distance(lat_a: float, lng_a: float, lat_b: float, lng_b: float) -> float:
+        """Great-circle distance in meters."""
+
+        lat_a, lng_a, lat_b, lng_b = map(math.radians, (lat_a, lng_a, lat_b, lng_b))
+
+        a = math.sin((lat_b - lat_a) / 2) ** 2 + \
+            math.cos(lat_a) * math.cos(lat_b) * math.sin((lng_b - lng_a) / 2) ** 2
+
+        return 2 * 6371000 * math.asin(math.sqrt(a))
+
     @property
     def is_idle(self):
         return self.dist == 0
@@ -109,6 +269,208 @@ class Probe(db.Model):
     def has_coordinates(self):
         return self.lat != 0 and self.lng != 0
 
+class Heartbeat(db.Model):
+    """The tracker status, sent instead of a location when the location did not change (see
+    `radio_t::heartbeat_msg_t` in the firmware)."""
+
+    __tablename__ = 'heartbeats'
+
+    id = db.Column(db.Integer, primary_key=True)
+
+    received_at = db.Column(db.DateTime(), nullable=False, default=datetime.datetime.utcnow)
+
+    tracking = db.Column(db.Boolean, nullable=False)
+    parked = db.Column(db.Boolean, nullable=False)
+    motion = db.Column(db.Boolean, nullable=False)
+
+    n_buffered = db.Column(db.Integer, nullable=False)
+    battery = db.Column(db.Float, nullable=False)       # volts
+
+    @staticmethod
+    def decode(data: bytes) -> 'Heartbeat':
+        return Heartbeat(
+            tracking=bool(data[0] & 0x80),
+            parked=bool(data[0] & 0x40),
+            motion=bool(data[0] & 0x20),
+            n_buffered=data[0] & 0x1f,
+            battery=data[1] / 50,
+        )
+
+    @property
+    def received_at_local(self) -> datetime.datetime:
+        return self.received_at.replace(tzinfo=pytz.UTC).astimezone(tz=timezone)
+
+class Trip(db.Model):
+    """The summary of a trip, computed by the tracker from all its probes and sent once it ended
+    (see `radio_t::trip_msg_t` in the firmware)."""
+
+    __tablename__ = 'trips'
+
+    id = db.Column(db.Integer, primary_key=True)
+
+    received_at = db.Column(db.DateTime(), nullable=False, default=datetime.datetime.utcnow)
+
+    # Incremented by the tracker for every trip, wrapping around after 255.
+    seq = db.Column(db.Integer, nullable=False)
+
+    started_at = db.Column(db.DateTime(), nullable=False)
+    ended_at = db.Column(db.DateTime(), nullable=False)
+
+    distance = db.Column(db.Integer, nullable=False)        # m
+    alt_gain = db.Column(db.Integer, nullable=False)        # m
+    moving_time = db.Column(db.Integer, nullable=False)     # secs
+    max_speed = db.Column(db.Float, nullable=False)         # m/s
+
+    activity_id = db.Column(db.Integer, db.ForeignKey('activities.id'), nullable=True)
+
+    @staticmethod
+    def decode(data: bytes, received_at: datetime.datetime) -> 'Trip':
+        value = int.from_bytes(data, 'big')
+        offset = len(data) * 8
+
+        def read(n_bits: int) -> int:
+            nonlocal offset
+            offset -= n_bits
+            return (value >> offset) & ((1 << n_bits) - 1)
+
+        seq = read(8)
+        ended_at = received_at - datetime.timedelta(minutes=read(6))
+        duration = datetime.timedelta(seconds=read(14) * 16)
+
+        return Trip(
+            received_at=received_at,
+            seq=seq,
+            started_at=ended_at - duration,
+            ended_at=ended_at,
+            moving_time=read(14) * 16,
+            distance=read(15) * 20,
+            alt_gain=read(9) * 8,
+            max_speed=read(6) / 2,
+        )
+
+    @property
+    def moving_time_td(self) -> datetime.timedelta:
+        return datetime.timedelta(seconds=self.moving_time)
+
+    @property
+    def started_at_local(self) -> datetime.datetime:
+        return self.started_at.replace(tzinfo=pytz.UTC).astimezone(tz=timezone)
+
+    @property
+    def ended_at_local(self) -> datetime.datetime:
+        return self.ended_at.replace(tzinfo=pytz.UTC).astimezone(tz=timezone)
+
+class DeviceConfig(db.Model):
+    """A configuration command, sent to the tracker in the callback response of its next probe
+    (see `radio_t::config_cmd_t` in the firmware)."""
+
+    __tablename__ = 'device_configs'
+
+    VERSION = 1
+
+    FLAG_RESET = 0x01
+
+    id = db.Column(db.Integer, primary_key=True)
+
+    created_at = db.Column(db.DateTime(), nullable=False, default=datetime.datetime.utcnow)
+
+    # Set once the command has been answered to the tracker.
+    sent_at = db.Column(db.DateTime(), nullable=True, index=True)
+
+    # Restores the firmware profile settings before applying the fields below.
+    reset = db.Column(db.Boolean, nullable=False, default=False)
+
+    # Unchanged if null.
+    gps_probe_delay = db.Column(db.Integer, nullable=True)     # secs
+    radio_delay = db.Column(db.Integer, nullable=True)         # secs
+    power_save_delay = db.Column(db.Integer, nullable=True)    # secs
+    idle_probes = db.Column(db.Integer, nullable=True)
+    still_delay = db.Column(db.Integer, nullable=True)         # secs
+    forced_tracking = db.Column(db.Integer, nullable=True)     # secs
+
+    @property
+    def downlink_data(self) -> str:
+        """The command as a 8 byte hexadecimal string."""
+
+        def scaled(value: Optional[int], unit: int) -> int:
+            if not value:
+                return 0
+            return min(max(round(value / unit), 1), 255)
+
+        fields = [
+            self.VERSION,
+            self.FLAG_RESET if self.reset else 0,
+            scaled(self.gps_probe_delay, 1),
+            scaled(self.radio_delay, 8),
+            scaled(self.power_save_delay, 60),
+            scaled(self.idle_probes, 1),
+            scaled(self.still_delay, 8),
+            scaled(self.forced_tracking, 60),
+        ]
+
+        return bytes(fields).hex()
+
+    @staticmethod
+    def pending() -> Optional['DeviceConfig']:
+        """Returns the latest command not yet sent, if any."""
+        return DeviceConfig.query                       \
+            .filter(DeviceConfig.sent_at.is_(None))     \
+            .order_by(DeviceConfig.id.desc())           \
+            .first()
+
+class DeviceZone(db.Model):
+    """A parking zone command, setting or removing one of the tracker's parking zones in the
+    callback response of its next probe (see `radio_t::zone_cmd_t` in the firmware)."""
+
+    __tablename__ = 'device_zones'
+
+    VERSION = 2
+
+    SLOTS = 4
+    RADIUS_STEP = 25    # meters
+    MAX_RADIUS = 31 * RADIUS_STEP
+
+    id = db.Column(db.Integer, primary_key=True)
+
+    created_at = db.Column(db.DateTime(), nullable=False, default=datetime.datetime.utcnow)
+
+    # Set once the command has been answered to the tracker.
+    sent_at = db.Column(db.DateTime(), nullable=True, index=True)
+
+    slot = db.Column(db.Integer, nullable=False)
+
+    lat = db.Column(db.Float, nullable=False)
+    lng = db.Column(db.Float, nullable=False)
+
+    # Removes the zone if 0.
+    radius = db.Column(db.Integer, nullable=False)     # meters
+
+    @property
+    def downlink_data(self) -> str:
+        """The command as a 8 byte hexadecimal string."""
+
+        def quantized(value: float, offset: float, range: float) -> bytes:
+            units = round((value + offset) / range * (1 << 24))
+            return min(max(units, 0), (1 << 24) - 1).to_bytes(3, 'big')
+
+        radius = min(round(self.radius / self.RADIUS_STEP), 31)
+        if self.radius > 0:
+            radius = max(radius, 1)
+
+        data = bytes([self.VERSION, (self.slot << 5) | radius]) \
+            + quantized(self.lat, 90, 180)                      \
+            + quantized(self.lng, 180, 360)
+
+        return data.hex()
+
+    @staticmethod
+    def pending() -> Optional['DeviceZone']:
+        """Returns the oldest command not yet sent, if any."""
+        return DeviceZone.query                         \
+            .filter(DeviceZone.sent_at.is_(None))       \
+            .order_by(DeviceZone.id)                    \
+            .first()
+
 class StravaAccessToken(db.Model):
     __tablename__ = 'strava_access_token'
 
@@ -119,14 +481,103 @@ class StravaAccessToken(db.Model):
 
 @app.route('/')
 def index():
-    """Shows a dashboard with the latest GPS locations of the tracker."""
+    """Shows a dashboard with the latest GPS locations of the tracker, `PROBES_PER_PAGE` per
+    page."""
+
+    page = Probe.query                                          \
+        .order_by(Probe.received_at.desc(), Probe.id.desc())    \
+        .paginate(
+            page=request.args.get('page', 1, type=int), per_page=PROBES_PER_PAGE,
+            error_out=False
+        )
 
-    probes = Probe.query                            \
-        .order_by(Probe.received_at.desc())         \
-        .limit(1000)                                \
-        .all()
+    return render_template(
+        'index.html',
+        timezone=timezone, probes=page.items, page=page, pending_config=DeviceConfig.pending(),
+        pending_zone=DeviceZone.pending(),
+        heartbeat=Heartbeat.query.order_by(Heartbeat.id.desc()).first()
+    )
+
+class DeviceConfigForm(wtforms.Form):
+    reset = wtforms.BooleanField('Restore the profile settings')
+
+    optional = [wtforms.validators.Optional(), wtforms.validators.NumberRange(min=1)]
 
-    return render_template('index.html', timezone=timezone, probes=probes)
+    gps_probe_delay = wtforms.IntegerField('GPS probe delay (secs)', optional)
+    radio_delay = wtforms.IntegerField('Radio delay (secs)', optional)
+    power_save_delay = wtforms.IntegerField('Power save GPS probe delay (secs)', optional)
+    idle_probes = wtforms.IntegerField('Idle probes', optional)
+    still_delay = wtforms.IntegerField('Still delay (secs)', optional)
+    forced_tracking = wtforms.IntegerField('Forced tracking (secs)', optional)
+
+@app.route('/device-config', methods=['POST'])
+def new_device_config():
+    """Queues a configuration command, replacing any command not sent yet."""
+
+    form = DeviceConfigForm(request.form)
+
+    if form.validate():
+        DeviceConfig.query                          \
+            .filter(DeviceConfig.sent_at.is_(None)) \
+            .delete()
+
+        config = DeviceConfig()
+        form.populate_obj(config)
+
+        db.session.add(config)
+        db.session.commit()
+
+        return redirect(url_for('index'))
+    else:
+        print(form.errors)
+        return 'Bad request', 400
+
+class DeviceZoneForm(wtforms.Form):
+    slot = wtforms.IntegerField(
+        'Zone', [
+            wtforms.validators.InputRequired(),
+            wtforms.validators.NumberRange(min=0, max=DeviceZone.SLOTS - 1)
+        ]
+    )
+
+    lat = wtforms.FloatField(
+        'Latitude',
+        [wtforms.validators.InputRequired(), wtforms.validators.NumberRange(min=-90, max=90)]
+    )
+    lng = wtforms.FloatField(
+        'Longitude',
+        [wtforms.validators.InputRequired(), wtforms.validators.NumberRange(min=-180, max=180)]
+    )
+
+    radius = wtforms.IntegerField(
+        'Radius (meters, 0 to remove the zone)', [
+            wtforms.validators.InputRequired(),
+            wtforms.validators.NumberRange(min=0, max=DeviceZone.MAX_RADIUS)
+        ]
+    )
+
+@app.route('/device-zone', methods=['POST'])
+def new_device_zone():
+    """Queues a parking zone command, replacing any command not sent yet for the same zone."""
+
+    form = DeviceZoneForm(request.form)
+
+    if form.validate():
+        DeviceZone.query                                \
+            .filter(DeviceZone.sent_at.is_(None))       \
+            .filter(DeviceZone.slot == form.slot.data)  \
+            .delete()
+
+        zone = DeviceZone()
+        form.populate_obj(zone)
+
+        db.session.add(zone)
+        db.session.commit()
+
+        return redirect(url_for('index'))
+    else:
+        print(form.errors)
+        return 'Bad request', 400
 
 class ProbeForm(wtforms.Form):
     device = wtforms.StringField('Device ID', [wtforms.validators.InputRequired()])
@@ -141,49 +592,276 @@ class ProbeForm(wtforms.Form):
     alt_gain = wtforms.IntegerField('Elevation gain', [wtforms.validators.InputRequired()])
     moving_time = wtforms.IntegerField('Moving time', [wtforms.validators.InputRequired()])
 
+    # Set by the SigFox callback (`{ack}`) if the tracker waits for a downlink.
+    ack = wtforms.BooleanField('Downlink requested')
+
     def validate_device(form, field):
         if field.data != os.environ['DEVICE_ID']:
             raise wtforms.ValidationError('Invalid device ID.')
 
+class ProbePayloadForm(wtforms.Form):
+    device = wtforms.StringField('Device ID', [wtforms.validators.InputRequired()])
+
+    seq = wtforms.IntegerField('Sequence number', [wtforms.validators.InputRequired()])
+
+    payload = wtforms.StringField(
+        'Payload', [wtforms.validators.InputRequired(), wtforms.validators.Length(min=24, max=24)]
+    )
+
+    # Set by the SigFox callback (`{ack}`) if the tracker waits for a downlink.
+    ack = wtforms.BooleanField('Downlink requested')
+
+    validate_device = ProbeForm.validate_device
+
+    def validate_payload(form, field):
+        try:
+            Probe.decode(bytes.fromhex(field.data), 0)
+        except ValueError:
+            raise wtforms.ValidationError('Invalid payload.')
+
 @app.route('/new-probe', methods=['POST'])
 def new_probe():
-    """Saves a location in the database. Returns a `201 Created` response on success."""
+    """Saves a location in the database. Returns a `201 Created` response on success.
 
-    form = ProbeForm(request.form)
-
-    if form.validate():
-        probe = Probe(
-            seq=form.seq.data,
+    Accepts either the raw 12 bytes hexadecimal payload of the location message, or the fields of
+    the legacy message (floats and fixed scale bytes) as decoded by the SigFox callback."""
 
-            lat=form.lat.data,
-            lng=form.lng.data,
-            alt=form.alt.data * 8,
+    if 'payload' in request.form:
+        form = ProbePayloadForm(request.form)
+    else:
+        form = ProbeForm(request.form)
 
-            dist=form.dist.data * 16,
-            alt_gain=form.alt_gain.data * 2,
-            moving_time=form.moving_time.data * 8,
-        )
+    if form.validate():
+        if isinstance(form, ProbePayloadForm):
+            probe = Probe.decode(bytes.fromhex(form.payload.data), form.seq.data)
+        else:
+            probe = Probe(
+                seq=form.seq.data,
+
+                lat=form.lat.data,
+                lng=form.lng.data,
+                alt=form.alt.data * 8,
+
+                dist=form.dist.data * 16,
+                alt_gain=form.alt_gain.data * 2,
+                moving_time=form.moving_time.data * 8,
+            )
 
         db.session.add(probe)
         db.session.flush()
 
         process_probe(probe)
 
+        # Answers with the pending command, if any. Otherwise answers with the backend probe ID,
+        # as 8 byte hexadecimal string, which the tracker ignores.
+        downlink_data = pending_downlink_data(form.ack.data) or hex(probe.id)[2:].rjust(8 * 2, '0')
+
         db.session.commit()
 
-        # Answers with the backend probe ID, as 8 byte hexadecimal string
-        response = {
-            form.device.data: {
-                'downlinkData': hex(probe.id)[2:].rjust(8 * 2, '0')
-            }
-        }
+        return callback_response(form, downlink_data)
+    else:
+        print(form.errors)
+        return 'Bad request', 400
+
+class TrackForm(ProbePayloadForm):
+    # 12 bytes track messages, or 11 bytes backlog messages.
+    payload = wtforms.StringField(
+        'Payload', [wtforms.validators.InputRequired(), wtforms.validators.Length(min=22, max=24)]
+    )
+
+    # Time between the locations of a track message, in seconds.
+    interval = wtforms.IntegerField(
+        'Interval', [wtforms.validators.Optional(), wtforms.validators.NumberRange(min=1)]
+    )
+
+    def validate_payload(form, field):
+        try:
+            data = bytes.fromhex(field.data)
+        except ValueError:
+            raise wtforms.ValidationError('Invalid payload.')
+
+        if len(data) not in (11, 12):
+            raise wtforms.ValidationError('Invalid payload.')
+
+@app.route('/new-track', methods=['POST'])
+def new_track():
+    """Saves the locations of a track message (`radio_t::track_msg_t` in the firmware) or of a
+    backlog message (`radio_t::backlog_msg_t`), from its raw hexadecimal payload, as one probe
+    each. Returns a `201 Created` response on success.
+
+    The backlog messages give the age of their locations, saturated at 68 minutes (for older
+    locations, or locations probed before a power loss that the tracker could not date yet). The
+    locations of track messages are assumed to be `interval` seconds apart (`TRACK_INTERVAL` by
+    default), the most recent one being received now."""
+
+    form = TrackForm(request.form)
+
+    if form.validate():
+        data = bytes.fromhex(form.payload.data)
+        now = datetime.datetime.utcnow()
+
+        if len(data) == 11:
+            latest_at = now - datetime.timedelta(seconds=data[0] * 16)
+            interval = datetime.timedelta(seconds=data[1] * 8)
+            points = Probe.decode_track(data[2:])
+        else:
+            latest_at = now
+            if form.interval.data:
+                interval = datetime.timedelta(seconds=form.interval.data)
+            else:
+                interval = TRACK_INTERVAL
+            points = Probe.decode_track(data)
+
+        # Adds the oldest location first, as the activities expect increasing probe IDs.
+        previous = Probe.query                      \
+            .filter(Probe.lat.isnot(None))          \
+            .filter(Probe.lat != 0)                 \
+            .order_by(Probe.id.desc())              \
+            .first()
+
+        probes = []
+        for i, (lat, lng) in reversed(list(enumerate(points))):
+            probe = Probe(
+                seq=form.seq.data, received_at=latest_at - i * interval, lat=lat, lng=lng,
+                dist=0, alt_gain=0, moving_time=0,
+            )
+
+            if previous and probe.received_at > previous.received_at:
+                dist = Probe.distance(previous.lat, previous.lng, lat, lng)
+                elapsed = (probe.received_at - previous.received_at).total_seconds()
+
+                if dist / elapsed >= IDLE_SPEED:
+                    probe.dist = round(dist)
+                    probe.moving_time = round(elapsed)
+
+            db.session.add(probe)
+            probes.append(probe)
+            previous = probe
+
+        db.session.flush()
+
+        for probe in probes:
+            process_probe(probe)
+
+        downlink_data = pending_downlink_data(form.ack.data) or '0' * (8 * 2)
+
+        db.session.commit()
+
+        return callback_response(form, downlink_data)
+    else:
+        print(form.errors)
+        return 'Bad request', 400
+
+class HeartbeatForm(wtforms.Form):
+    device = wtforms.StringField('Device ID', [wtforms.validators.InputRequired()])
+
+    payload = wtforms.StringField(
+        'Payload', [wtforms.validators.InputRequired(), wtforms.validators.Length(min=4, max=4)]
+    )
+
+    # Set by the SigFox callback (`{ack}`) if the tracker waits for a downlink.
+    ack = wtforms.BooleanField('Downlink requested')
+
+    validate_device = ProbeForm.validate_device
+
+    def validate_payload(form, field):
+        try:
+            bytes.fromhex(field.data)
+        except ValueError:
+            raise wtforms.ValidationError('Invalid payload.')
+
+@app.route('/new-heartbeat', methods=['POST'])
+def new_heartbeat():
+    """Saves a heartbeat message, from its raw 2 bytes hexadecimal payload. Returns a
+    `201 Created` response on success."""
+
+    form = HeartbeatForm(request.form)
+
+    if form.validate():
+        heartbeat = Heartbeat.decode(bytes.fromhex(form.payload.data))
+        db.session.add(heartbeat)
+
+        downlink_data = pending_downlink_data(form.ack.data) or '0' * (8 * 2)
 
-        return jsonify(response), 201
+        db.session.commit()
+
+        return callback_response(form, downlink_data)
     else:
         print(form.errors)
         return 'Bad request', 400
 
+class TripForm(HeartbeatForm):
+    payload = wtforms.StringField(
+        'Payload', [wtforms.validators.InputRequired(), wtforms.validators.Length(min=18, max=18)]
+    )
+
+@app.route('/new-trip', methods=['POST'])
+def new_trip():
+    """Saves a trip summary, from its raw 9 bytes hexadecimal payload, and attaches it to the
+    activity it ended. Returns a `201 Created` response on success."""
+
+    form = TripForm(request.form)
+
+    if form.validate():
+        trip = Trip.decode(bytes.fromhex(form.payload.data), datetime.datetime.utcnow())
+        db.session.add(trip)
+
+        latest_activity = Activity.query        \
+            .order_by(Activity.id.desc())       \
+            .first()
+
+        if (
+            latest_activity and latest_activity.ended_at is not None and
+            latest_activity.ended_at >= trip.started_at
+        ):
+            trip.activity = latest_activity
+
+        downlink_data = pending_downlink_data(form.ack.data) or '0' * (8 * 2)
+
+        db.session.commit()
+
+        return callback_response(form, downlink_data)
+    else:
+        print(form.errors)
+        return 'Bad request', 400
+
+def callback_response(form: wtforms.Form, downlink_data: str):
+    """The `201 Created` response to a SigFox callback. Only answers with `downlink_data` if the
+    tracker requested a downlink, as SigFox ignores it otherwise."""
+
+    if not form.ack.data:
+        return '', 201
+
+    response = {
+        form.device.data: {
+            'downlinkData': downlink_data
+        }
+    }
+
+    return jsonify(response), 201
+
+def pending_downlink_data(ack: bool) -> Optional[str]:
+    """Marks the pending configuration command as sent, if any, or else the oldest pending parking
+    zone command, and returns it as a 8 byte hexadecimal string.
+
+    Does nothing if the tracker did not request a downlink (`ack`), as the command would otherwise
+    be marked as sent without ever reaching it."""
+
+    if not ack:
+        return None
+
+    command = DeviceConfig.pending() or DeviceZone.pending()
+
+    if command:
+        command.sent_at = datetime.datetime.utcnow()
+        return command.downlink_data
+    else:
+        return None
+
 def process_probe(probe: Probe) -> Optional[Activity]:
+    """Associates the probe with the latest activity, or with a new one. Only relies on the
+    activity aggregates, not on its probes."""
+
     if probe.is_idle:
         return None
 
@@ -194,20 +872,22 @@ def process_probe(probe: Probe) -> Optional[Activity]:
         .order_by(Activity.id.desc())       \
         .first()
 
-    if latest_activity:
-        probes = latest_activity.probes
-
-        if probe.received_at - probes[-1].received_at < INACTIVITY_DELAY:
-            # We can associate the probe with an existsing activity.
-            activity = latest_activity
-
-            # First we associate all idle activities in between with the activity.
-            idle_probes = Probe.query                   \
-                .filter(Probe.id > probes[-1].id)       \
-                .filter(Probe.id < probe.id)            \
-                .all()
-            for p in idle_probes:
-                activity.probes.append(p)
+    if (
+        latest_activity and latest_activity.ended_at is not None and
+        probe.received_at - latest_activity.ended_at < INACTIVITY_DELAY
+    ):
+        # We can associate the probe with an existsing activity.
+        activity = latest_activity
+
+        # First we associate all idle activities in between with the activity.
+        idle_probes = Probe.query                                   \
+            .filter(Probe.id > latest_activity.last_probe_id)       \
+            .filter(Probe.id < probe.id)                            \
+            .filter(Probe.activity_id.is_(None))                    \
+            .order_by(Probe.id)                                     \
+            .all()
+        for p in idle_probes:
+            activity.add_probe(p)
 
     if activity is None:
         # We couldn't associate the latest activity with the probe. Create a new activity.
@@ -217,13 +897,14 @@ def process_probe(probe: Probe) -> Optional[Activity]:
 
         # The activity should start on the latest position where we were not moving.
         prev_probe = Probe.query                \
-            .order_by(Probe.id.desc())            \
+            .filter(Probe.id < probe.id)        \
+            .order_by(Probe.id.desc())          \
             .first()
 
-        if prev_probe and prev_probe.is_idle and prev_probe.has_coordinates():
-            activity.probes.append(prev_probe)
+        if prev_probe and prev_probe.is_idle and prev_probe.has_coordinates:
+            activity.add_probe(prev_probe)
 
-    activity.probes.append(probe)
+    activity.add_probe(probe)
 
     return activity
 
@@ -253,7 +934,14 @@ def activity_merge_into(id: int, other_id: int):
         .filter(Probe.activity_id == id)        \
         .update({Probe.activity_id: other_id})
 
+    Trip.query                                  \
+        .filter(Trip.activity_id == id)         \
+        .update({Trip.activity_id: other_id})
+
     db.session.delete(act)
+    db.session.flush()
+
+    other_act.recompute()
 
     db.session.commit()
 
@@ -393,6 +1081,63 @@ def get_strava_access_token() -> str:
 
         return access_token
 
-if __name__ == '__main__':
+# Columns added to the tables of existing databases, which `db.create_all()` does not alter. They
+# should either be nullable or have a server default, for the existing rows.
+ADDED_COLUMNS = [
+    Probe.__table__.c.saturated,
+
+    Activity.__table__.c.started_at,
+    Activity.__table__.c.ended_at,
+    Activity.__table__.c.last_probe_id,
+    Activity.__table__.c.probes_distance,
+    Activity.__table__.c.probes_alt_gain,
+    Activity.__table__.c.probes_moving_time,
+]
+
+def upgrade_db():
+    """Creates the missing tables, and adds the missing `ADDED_COLUMNS` to the existing ones.
+    Recomputes the activity aggregates if they have just been added."""
+
     db.create_all(app=app)
+
+    inspector = inspect(db.engine)
+    added_tables = set()
+
+    for column in ADDED_COLUMNS:
+        table = column.table.name
+        if column.name in (c['name'] for c in inspector.get_columns(table)):
+            continue
+
+        ddl = CreateColumn(column).compile(dialect=db.engine.dialect)
+        db.session.execute(text(f'ALTER TABLE {table} ADD COLUMN {ddl}'))
+        print(f'Added column {table}.{column.name}')
+
+        added_tables.add(table)
+
+    db.session.commit()
+
+    if Activity.__tablename__ in added_tables:
+        recompute_activities_aggregates()
+
+def recompute_activities_aggregates():
+    for activity in Activity.query.order_by(Activity.id):
+        activity.recompute()
+
+    db.session.commit()
+
+@app.cli.command('upgrade-db')
+def upgrade_db_command():
+    """Upgrades the schema of an existing database (see `upgrade_db()`)."""
+
+    upgrade_db()
+
+@app.cli.command('recompute-activities')
+def recompute_activities():
+    """Recomputes the aggregates of every activity, e.g. after merging activities by hand."""
+
+    recompute_activities_aggregates()
+
+if __name__ == '__main__':
+    with app.app_context():
+        upgrade_db()
     app.run()
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+
+#include <Arduino.h>
+#include <etl/optional.h>
+
+#include "logger.hpp"
+
+namespace bike_tracker {
+
+// Monitors the voltage of the two AA batteries, measured on `ADC_BATTERY` through the board's
+// voltage divider.
+//
+// The voltage is sampled at most every `SAMPLE_DELAY`, as the average of `N_READINGS` ADC
+// readings, and smoothed over the successive samples so that the load of a short radio or GPS
+// activity does not make the level jump.
+class battery_t {
+public:
+    // Fresh alkaline cells are at about 1.5 V, and considered empty at 1.0 V, below which the
+    // board browns out.
+    static constexpr float FULL_VOLTAGE = 3.0f;     // volts
+    static constexpr float EMPTY_VOLTAGE = 2.0f;    // volts
+
+    void setup()
+    {
+        analogReference(AR_DEFAULT);
+        analogReadResolution(ADC_BITS);
+    }
+
+    // Samples the voltage if the previous sample is older than `SAMPLE_DELAY`.
+    void update(uint32_t now)
+    {
+        if (last_sample_time_.has_value() && now - *last_sample_time_ < SAMPLE_DELAY) {
+            return;
+        }
+
+        uint32_t sum = 0;
+        for (size_t i = 0; i < N_READINGS; ++i) {
+            sum += analogRead(ADC_BATTERY);
+        }
+
+        float voltage =
+            (float) sum / N_READINGS / ((1 << ADC_BITS) - 1) * REFERENCE_VOLTAGE * DIVIDER_RATIO;
+
+        if (last_sample_time_.has_value()) {
+            voltage_ = voltage_ * (1.0f - SMOOTHER_FACTOR) + voltage * SMOOTHER_FACTOR;
+        } else {
+            voltage_ = voltage;
+        }
+
+        last_sample_time_ = now;
+
+        if constexpr (logger::LEVEL >= logger::level_t::INFO) {
+            logger::info(
+                "Battery: ", logger::fixed(voltage_, 2), " V - ", level(), "% ",
+                "(sample: ", logger::fixed(voltage, 2), " V)");
+        }
+    }
+
+    // The smoothed voltage, in volts. 0 until the first sample.
+    float voltage() const
+    {
+        return voltage_;
+    }
+
+    // The remaining charge, in percent, linearly estimated from the voltage.
+    uint8_t level() const
+    {
+        float ratio = (voltage_ - EMPTY_VOLTAGE) / (FULL_VOLTAGE - EMPTY_VOLTAGE);
+
+        return round(constrain(ratio, 0.0f, 1.0f) * 100);
+    }
+
+private:
+    static constexpr uint32_t SAMPLE_DELAY = 5 * 60; // sec
+    static constexpr size_t N_READINGS = 8;
+
+    static constexpr float SMOOTHER_FACTOR = 0.25f; // ratio
+
+    static constexpr uint8_t ADC_BITS = 12;
+    static constexpr float REFERENCE_VOLTAGE = 3.3f; // volts
+
+    // The battery is connected to the ADC through a 330 kΩ / 1 MΩ divider.
+    static constexpr float DIVIDER_RATIO = (330.0f + 1000.0f) / 1000.0f;
+
+    etl::optional<uint32_t> last_sample_time_;
+
+    float voltage_{0.0f};
+};
+
+}
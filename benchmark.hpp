@@ -0,0 +1,147 @@
+#pragma once
+
+#include <cstdint>
+
+#include <Arduino.h>
+
+#ifndef ARDUINO
+#include <chrono>
+#endif
+
+// Measures the cycles and the awake time spent in the hot stages of the firmware, when built with
+// `BIKE_TRACKER_BENCHMARK` defined. Otherwise, the measures are compiled away.
+//
+// Cycles are counted with the DWT cycle counter when the core has one (Cortex-M3 and above), with
+// SysTick on the Cortex-M0+ of the SAMD21, and with the steady clock on the host (where a cycle is
+// a nanosecond). The awake time is measured with `millis()`, so that it includes the time spent
+// blocking on the GPS or the radio.
+namespace bike_tracker::benchmark {
+
+enum class stage_t : uint8_t { LOOP, GPS_PROBE, DISTANCE, LOCATION_MSG, LOG };
+
+constexpr size_t N_STAGES = 5;
+
+const char *const NAMES[N_STAGES] = {
+    "loop()", "probe_gps()", "gps_t::distance()", "send_location_msg()", "logger::write()"
+};
+
+#ifdef BIKE_TRACKER_BENCHMARK
+constexpr bool ENABLED = true;
+#else
+constexpr bool ENABLED = false;
+#endif
+
+struct stats_t {
+    uint32_t n_calls{0};
+
+    uint64_t cycles{0};
+    uint32_t max_cycles{0};
+
+    uint64_t awake_ms{0};
+};
+
+stats_t stats_[N_STAGES];
+
+const stats_t &stats(stage_t stage)
+{
+    return stats_[static_cast<size_t>(stage)];
+}
+
+// Enables the cycle counter, if it has to be.
+void setup()
+{
+#if defined(ARDUINO) && defined(DWT_CTRL_CYCCNTENA_Msk)
+    if constexpr (ENABLED) {
+        CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+        DWT->CYCCNT = 0;
+        DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    }
+#endif
+}
+
+// A free running cycle counter, wrapping around. Only the difference between two values is
+// meaningful.
+uint32_t cycles()
+{
+#if defined(ARDUINO) && defined(DWT_CTRL_CYCCNTENA_Msk)
+    return DWT->CYCCNT;
+#elif defined(ARDUINO) && defined(SysTick_LOAD_RELOAD_Msk)
+    // SysTick counts down from LOAD every millisecond. Reads it again if the millisecond changed
+    // in between.
+    uint32_t ms, ticks;
+    do {
+        ms = millis();
+        ticks = SysTick->VAL;
+    } while (ms != millis());
+
+    uint32_t reload = SysTick->LOAD + 1;
+    return ms * reload + (reload - 1 - ticks);
+#elif defined(ARDUINO)
+    return micros() * (F_CPU / 1000000);
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// Accounts the cycles and the awake time from its construction to its destruction to the stage.
+class scope_t {
+public:
+    explicit scope_t(stage_t stage) :
+        stage_(stage)
+    {
+        if constexpr (ENABLED) {
+            started_at_ = cycles();
+            started_at_ms_ = millis();
+        }
+    }
+
+    ~scope_t()
+    {
+        if constexpr (ENABLED) {
+            uint32_t elapsed = cycles() - started_at_;
+
+            stats_t &s = stats_[static_cast<size_t>(stage_)];
+            ++s.n_calls;
+            s.cycles += elapsed;
+            s.max_cycles = max(s.max_cycles, elapsed);
+            s.awake_ms += millis() - started_at_ms_;
+        }
+    }
+
+private:
+    stage_t stage_;
+
+    uint32_t started_at_{0};
+    uint32_t started_at_ms_{0};
+};
+
+// Writes the measures of each stage to `out`, as a Markdown table to paste in before/after
+// comparisons. Does nothing if the benchmark is disabled.
+void print(Print &out)
+{
+    if constexpr (!ENABLED) {
+        return;
+    }
+
+    out.println("| Stage | Calls | Avg. cycles | Max. cycles | Awake ms |");
+    out.println("|---|---:|---:|---:|---:|");
+
+    for (size_t i = 0; i < N_STAGES; ++i) {
+        const stats_t &s = stats_[i];
+
+        out.print("| ");
+        out.print(NAMES[i]);
+        out.print(" | ");
+        out.print(s.n_calls);
+        out.print(" | ");
+        out.print(s.n_calls > 0 ? (unsigned long) (s.cycles / s.n_calls) : 0ul);
+        out.print(" | ");
+        out.print(s.max_cycles);
+        out.print(" | ");
+        out.print((unsigned long) s.awake_ms);
+        out.println(" |");
+    }
+}
+
+}
@@ -3,88 +3,153 @@
 #include <ctime>
 
 #include <Arduino.h>
+#include <FlashStorage.h>
 #include <RTCZero.h>
 #include <Embedded_Template_Library.h>
-#include <etl/queue.h>
+#include <etl/type_traits.h>
 
+#include "battery.hpp"
+#include "benchmark.hpp"
+#include "buttons.hpp"
+#include "energy.hpp"
 #include "gps.hpp"
 #include "leds.hpp"
 #include "logger.hpp"
 #include "movement.hpp"
+#include "position_filter.hpp"
+#include "probe_log.hpp"
+#include "profiles.hpp"
 #include "radio.hpp"
+#include "scheduler.hpp"
+#include "sliding_window.hpp"
+#include "state_store.hpp"
+#include "watchdog.hpp"
 
 namespace bike_tracker {
 
+// Tracks the bike using the constants and buffer sizes of `profile_t` (see `profiles.hpp`).
+template<typename profile_t = commuter_profile_t>
 class bike_tracker_t {
 public:
     enum class state_t { TRACKING, POWER_SAVE };
 
+    // Built with `BIKE_TRACKER_DEBUG` defined, staying awake instead of sleeping and logging every
+    // message (see `logger::LEVEL`).
+#ifdef BIKE_TRACKER_DEBUG
+    static constexpr bool DEBUG = true;
+#else
     static constexpr bool DEBUG = false;
+#endif
 
-    // Will consider the bike idle if it moves slower than 4kph between two GPS probes.
-    static constexpr float IDLE_THRESHOLD = 4.0f * 1000.0f / 3600.0f; // meters per sec
+    // In debug builds, the blue led is lit while awake.
+    static constexpr led_policy_t LED_POLICY = DEBUG ? led_policy_t::DEBUG : profile_t::LED_POLICY;
 
-    // Will wait 5 seconds after an unsuccessful GPS probe before trying again, up to 10 times.
-    // When the maximum number of retries is reached, considers the next unsuccessful probes as
-    // IDLE.
-    static constexpr uint32_t GPS_RETRY_DELAY = 5; // sec
-    static constexpr uint32_t GPS_MAX_RETRIES = 10;
-
-    // Will wait 1 minute after an unsuccessful radio message before trying again.
-    static constexpr uint32_t RADIO_RETRY_DELAY = 60; // sec
-
-    // Smooth the GPS altitude probes by using a recursive smoother.
-    static constexpr float GPS_ALT_SMOOTHER_FACTOR = 0.2f;  // ratio
-
-    // When in the TRACKING state, probes the location and speed every 20 seconds, and sends the
-    // location every 3 minutes, except for the first radio message being transmitted after 1 minute
-    // (about the time to get a GPS fix).
-    static constexpr uint32_t TRACKING_GPS_PROBE_DELAY      = 20;        // sec
-    static constexpr uint32_t TRACKING_RADIO_DELAY          = 3 * 60;    // sec
-    static constexpr uint32_t TRACKING_RADIO_FIRST_DELAY    = 60;        // sec
-
-    // The tracker will move into the POWER_SAVE state if there the sensor stayed idle for 9 of the
-    // last 12 location probes (4 minutes).
-    static constexpr uint32_t TRACKING_IDLE_PROBES      = 9;
-    static constexpr uint32_t TRACKING_IDLE_BUFFER_SIZE = 12;
-
-    // When in POWER_SAVE mode, probes and transmit the location every 60 minutes.
-    static constexpr uint32_t POWER_SAVE_GPS_PROBE_DELAY = 60 * 60;  // sec
+    // Message used to transmit locations, see `commuter_profile_t::location_msg_t`.
+    using location_msg_t = typename profile_t::location_msg_t;
 
     void setup()
     {
         led_t::setup_all();
+        button_t::setup_all();
+
+        led_activity.policy(LED_POLICY);
+        led_activity.awake();
+
+        // The watchdog uses the RTC clock.
+        clock_.begin();
 
-        for (led_t *led : led_t::all) {
-            led->on();
+        if (watchdog::caused_reset()) {
+            logger::warning("Reset by the watchdog.");
         }
+        watchdog::setup();
+        watchdog::start(SETUP_TIMEOUT);
 
         gps_.instance.setup();
         radio_.instance.setup();
         movement_.detector.setup();
+        battery_.monitor.setup();
+        benchmark::setup();
 
-        clock_.begin();
-        clock_.setY2kEpoch(0);
+        bool restored = restore_state();
+
+        if (!restored) {
+            clock_.setY2kEpoch(0);
+
+            scheduler_.schedule(task_t::GPS_PROBE, 0);
+            scheduler_.schedule(task_t::LOCATION_MSG, profile_t::TRACKING_RADIO_FIRST_DELAY);
+        }
+
+        if constexpr (profile_t::TELEMETRY_ENABLED) {
+            scheduler_.schedule(
+                task_t::TELEMETRY_MSG, clock_.getY2kEpoch() + profile_t::TELEMETRY_DELAY);
+        }
 
-        for (led_t *led : led_t::all) {
-            led->off();
+        if constexpr (profile_t::PROBE_LOG_PERSISTENT) {
+            // Starts the clock after the restored probes, unless it has been restored too, and
+            // sends them after the next message.
+            FlashStorageClass<probe_log_t::snapshot_t> storage = probe_log_storage();
+            uint32_t now = gps_.log.restore(storage, !restored);
+
+            if (!gps_.log.empty() && restored) {
+                radio_.backlog_time = now - 1;
+            } else if (!gps_.log.empty()) {
+                clock_.setY2kEpoch(now);
+                trip_.current.started_at = now;
+
+                scheduler_.schedule(task_t::GPS_PROBE, now);
+                scheduler_.schedule(
+                    task_t::LOCATION_MSG, now + profile_t::TRACKING_RADIO_FIRST_DELAY);
+                radio_.backlog_time = now - 1;
+            }
         }
     }
 
     void loop()
     {
-        led_t::blue.on(); // Blue LED in on during when the controller is awake.
+        led_activity.awake();
+        energy::start(energy::subsystem_t::MCU_AWAKE);
 
-        uint32_t now = clock_.getY2kEpoch();
+        {
+            benchmark::scope_t scope(benchmark::stage_t::LOOP);
 
-        switch (state_) {
-        case state_t::TRACKING:
-            loop_tracking(now);
-            break;
-        case state_t::POWER_SAVE:
-            loop_power_save(now);
-            break;
+            uint32_t now = clock_.getY2kEpoch();
+
+            update_battery(now);
+
+            if (button_t::a.was_pressed()) {
+                start_led_diagnostic(now);
+            }
+
+            if (state_ == state_t::POWER_SAVE && movement_.detector.detected()) {
+                // Movement detected, go to live tracking once the due tasks ran.
+                logger::info("Movement detected using movement detector.");
+                scheduler_.schedule(task_t::MOVEMENT, now);
+            }
+
+            while (etl::optional<task_t> task = scheduler_.pop_due(now)) {
+                watchdog::feed(TASK_TIMEOUT);
+                run(*task, now);
+            }
+
+            // The accelerometer might miss a smooth ride, its stillness only confirms an idle GPS
+            // probe.
+            if (
+                state_ == state_t::TRACKING && !forced_tracking(now) && (
+                    gps_.idle_probes.count() >= settings_.idle_probes || (
+                        gps_.idle_probes.size() > 0 && gps_.idle_probes.latest() &&
+                        movement_.detector.still_for(now) >= settings_.still_delay))
+            ) {
+                // Idle for to much time, go to power save.
+                to_power_save(now);
+            }
+
+            // Blinks the events right after, before sleeping.
+            if (led_activity.pending()) {
+                scheduler_.schedule(task_t::LEDS, now);
+            }
         }
+
+        sleep();
     }
 
 private:
@@ -92,223 +157,734 @@ private:
 
     RTCZero clock_{};
 
+    // Unix epoch of 2000-01-01, the origin of `RTCZero::getY2kEpoch()`.
+    static constexpr uint32_t Y2K_UNIX_EPOCH = 946684800;
+
+    // Corrects the RTC when it drifted by 2 seconds or more from the GPS time. Smaller differences
+    // might come from the RTC and GPS seconds not being aligned.
+    static constexpr int32_t CLOCK_MAX_DRIFT = 1; // sec
+
+    // The GPS time minus the RTC epoch, measured on the first GPS time. Undefined until then.
+    etl::optional<uint32_t> clock_offset_;
+
+    // End of the events blinking started by the button, if any.
+    etl::optional<uint32_t> led_diagnostic_until_;
+
+    // The board is reset by the watchdog if the setup or a task takes longer, e.g. if a
+    // peripheral hangs. Every GPS and radio command has its own timeout, well below these ones.
+    static constexpr uint32_t SETUP_TIMEOUT = 60 * 1000; // ms
+    static constexpr uint32_t TASK_TIMEOUT = 30 * 1000; // ms
+
+    // A task requesting a downlink also waits for the modem to listen for it.
+    static constexpr uint32_t DOWNLINK_TIMEOUT =
+        TASK_TIMEOUT + radio_t::DOWNLINK_DURATION * 1000; // ms
+
     enum class probe_result_t { NO_FIX, IDLE, MOVING, UNKNOWN };
 
-    struct {
-        gps_t instance;
+    // The message could not be sent, either because of the radio or because of the daily uplinks
+    // quota (see `retry_time()`).
+    enum class send_result_t { SENT, FAILED, QUOTA_REACHED };
+
+    // Tasks due at the same time run in this order. MOVEMENT runs last, so that the location
+    // probed in POWER_SAVE is sent before entering TRACKING.
+    enum class task_t : uint8_t {
+        GPS_PROBE, LOCATION_MSG, BACKLOG_MSG, TELEMETRY_MSG, TRIP_MSG, HEARTBEAT_MSG, LEDS,
+        MOVEMENT
+    };
+
+    static constexpr size_t N_TASKS = 8;
 
-        uint32_t next_probe_time{0};
+    scheduler_t<task_t, N_TASKS> scheduler_;
+
+    struct {
+        gps_t instance{profile_t::GNSS_CONSTELLATIONS};
 
         uint32_t n_retries{0};
 
         bool has_position{false}; // false until we get at least on successful GPS position.
-        gps_t::position_t last_position;
+        gps_t::position_t last_position;    // with the filtered coordinates
         uint32_t last_position_time;
 
-        float smoothed_alt;
+        position_filter_t filter{profile_t::GPS_FILTER_ACCELERATION, profile_t::GPS_FILTER_GATE};
+
+        // Horizontal speed and heading between the two last positions. Heading is only defined if
+        // the bike is moving.
+        float speed{0};                     // meters per sec
+        etl::optional<float> heading;       // degrees
+        float heading_change{0};            // degrees, since the previous MOVING probe
 
         // Accumulated since the last location message:
         float distance{0};          // meters
         float alt_gain{0};          // meters
         uint32_t moving_time{0};    // secs
 
-        // The number of previous GPS probes that did not exceed IDLE_THRESHOLD.
-        //
-        // Keep a buffer of the previous probes
-        etl::queue<bool, TRACKING_IDLE_BUFFER_SIZE> idle_probes{};
-        uint32_t n_idle{0};
+        // The previous GPS probes, true if they did not exceed IDLE_THRESHOLD.
+        sliding_window_t<profile_t::TRACKING_IDLE_BUFFER_SIZE> idle_probes{};
+
+        // The successful GPS probes since the last location message.
+        probe_log_t log{};
     } gps_;
 
+    // Settings the backend can override at runtime (see `radio_t::config_cmd_t`). Initialized
+    // with the profile constants.
+    struct settings_t {
+        uint32_t gps_probe_delay{profile_t::TRACKING_GPS_PROBE_DELAY};          // sec
+        uint32_t radio_delay{profile_t::TRACKING_RADIO_DELAY};                  // sec
+        uint32_t power_save_probe_delay{profile_t::POWER_SAVE_GPS_PROBE_DELAY}; // sec
+        uint32_t idle_probes{profile_t::TRACKING_IDLE_PROBES};
+        uint32_t still_delay{profile_t::TRACKING_STILL_DELAY};                  // sec
+
+        // Stays in TRACKING until then, whatever the movements. Undefined if not forced.
+        etl::optional<uint32_t> forced_tracking_until;
+    } settings_;
+
     struct {
         radio_t instance;
 
         etl::optional<uint32_t> last_msg_time;
 
-        // Undefined if no planned message.
-        etl::optional<uint32_t> next_msg_time{TRACKING_RADIO_FIRST_DELAY};
+        // The most recent location sent. Undefined if none has been sent since boot.
+        etl::optional<gps_t::coordinates_t> last_msg_coordinates;
+
+        // The logged probes up to this time could not be transmitted. Undefined if all the probes
+        // have been transmitted.
+        etl::optional<uint32_t> backlog_time;
+
+        // Successful uplinks and downlinks since the beginning of the current quota window.
+        uint32_t quota_window_start{0};
+        uint32_t n_uplinks{0};
+        uint32_t n_downlinks{0};
+
+        // The last downlink request, and the number of messages since then.
+        etl::optional<uint32_t> last_downlink_time;
+        uint32_t n_msgs_since_downlink{0};
     } radio_;
 
     struct {
         movement_detector_t detector{A1};
     } movement_;
 
-    void loop_tracking(uint32_t now)
-    {
-        if (now >= gps_.next_probe_time) {
-            probe_result_t result = probe_gps(now);
+    // Parking zones set by the backend (see `radio_t::zone_cmd_t`).
+    struct zone_t {
+        gps_t::coordinates_t center;
+        uint32_t radius;    // meters
+    };
 
-            handle_no_gps_fix(now, &result);
+    struct {
+        etl::optional<zone_t> table[profile_t::POWER_SAVE_ZONES];
 
-            if (result != probe_result_t::NO_FIX) {
-                gps_.next_probe_time = now + TRACKING_GPS_PROBE_DELAY;
+        // The zone the tracker is parked in, with the GPS probes suspended. Undefined if not in
+        // POWER_SAVE, or if parked out of any zone.
+        etl::optional<size_t> parked_in;
+    } zones_;
 
-                if (result != probe_result_t::UNKNOWN) {
-                    if (gps_.idle_probes.full()) {
-                        if (gps_.idle_probes.front()) {
-                            --gps_.n_idle;
-                        }
-                        gps_.idle_probes.pop();
-                    }
+    // Accumulated from the TRACKING state being entered to the POWER_SAVE state being entered
+    // again, whatever the location messages sent in between.
+    struct trip_t {
+        uint8_t id{0};
 
-                    bool is_idle = result == probe_result_t::IDLE;
+        uint32_t started_at{0};
+        uint32_t ended_at{0};
 
-                    if (is_idle) {
-                        ++gps_.n_idle;
-                    }
+        float distance{0};          // meters
+        float alt_gain{0};          // meters
+        uint32_t moving_time{0};    // secs
+        float max_speed{0};         // meters per sec
+    };
 
-                    gps_.idle_probes.push(is_idle);
-                }
-            }
-        }
+    struct {
+        trip_t current;
 
-        if (radio_.next_msg_time.has_value() && now >= radio_.next_msg_time) {
-            bool success = send_location_msg(now);
+        // The last ended trip, until its summary has been sent (see `radio_t::trip_msg_t`).
+        etl::optional<trip_t> ended;
 
-            if (success) {
-                radio_.next_msg_time = now + TRACKING_RADIO_DELAY;
-            } else {
-                radio_.next_msg_time = now + RADIO_RETRY_DELAY;
-            }
-        }
+        uint8_t next_id{0};
+    } trip_;
 
-        if (gps_.n_idle >= TRACKING_IDLE_PROBES) {
-            // Idle for to much time, go to power save.
-            to_power_save(now);
-        } else {
-            sleep(now);
+    // The state saved in flash on every state change, and restored after a reset (see
+    // `state_store_t`).
+    struct snapshot_t {
+        static constexpr uint8_t VERSION = 2;
+
+        uint32_t time; // RTC epoch
+        state_t state;
+
+        bool has_clock_offset;
+        uint32_t clock_offset;
+
+        bool has_position;
+        gps_t::coordinates_t last_coordinates;
+        uint32_t last_position_time;
+
+        // Accumulated since the last location message.
+        float distance;
+        float alt_gain;
+        uint32_t moving_time;
+
+        bool has_last_msg_time;
+        uint32_t last_msg_time;
+        bool has_last_downlink_time;
+        uint32_t last_downlink_time;
+        uint32_t quota_window_start;
+        uint32_t n_uplinks;
+        uint32_t n_downlinks;
+
+        trip_t trip;
+        bool has_ended_trip;
+        trip_t ended_trip;
+        uint8_t next_trip_id;
+
+        uint32_t gps_probe_delay;
+        uint32_t radio_delay;
+        uint32_t power_save_probe_delay;
+        uint32_t idle_probes;
+        uint32_t still_delay;
+        bool has_forced_tracking;
+        uint32_t forced_tracking_until;
+
+        bool has_zone[profile_t::POWER_SAVE_ZONES];
+        zone_t zones[profile_t::POWER_SAVE_ZONES];
+    };
+
+    state_store_t state_store_;
+
+    // The state is saved on every state change, and at most this often while tracking (see
+    // `state_store_t` for the flash endurance). A reset loses the trip progress since.
+    static constexpr uint32_t TRACKING_SAVE_DELAY = 60 * 60; // sec
+
+    // Undefined until the state has been saved since boot.
+    etl::optional<uint32_t> saved_at_; // RTC epoch
+
+    // The flash row holding the probe log (see `PROBE_LOG_PERSISTENT`). As this function is only
+    // instantiated by the profiles using it, the other ones do not reserve the row.
+    static FlashStorageClass<probe_log_t::snapshot_t> probe_log_storage()
+    {
+        FlashStorage(storage, probe_log_t::snapshot_t);
+        return storage;
+    }
+
+    struct {
+        battery_t monitor;
+
+        // The number of `BATTERY_STEP_LEVELS` the battery dropped below, each doubling the probe
+        // and radio delays.
+        size_t step{0};
+    } battery_;
+
+    struct {
+        // The charges at the time of the last telemetry message, in mAh.
+        float last_charge[energy::N_SUBSYSTEMS]{};
+    } telemetry_;
+
+    void run(task_t task, uint32_t now)
+    {
+        switch (task) {
+        case task_t::GPS_PROBE:
+            run_gps_probe(now);
+            break;
+        case task_t::LOCATION_MSG:
+            run_location_msg(now);
+            break;
+        case task_t::BACKLOG_MSG:
+            run_backlog_msg(now);
+            break;
+        case task_t::TELEMETRY_MSG:
+            run_telemetry_msg(now);
+            break;
+        case task_t::TRIP_MSG:
+            run_trip_msg(now);
+            break;
+        case task_t::HEARTBEAT_MSG:
+            run_heartbeat_msg(now);
+            break;
+        case task_t::LEDS:
+            run_leds(now);
+            break;
+        case task_t::MOVEMENT:
+            to_tracking(now);
+            break;
         }
     }
 
-    void loop_power_save(uint32_t now)
+    void run_gps_probe(uint32_t now)
     {
-        bool movement{false};
+        probe_result_t result = probe_gps(now);
+        bool has_fix = result != probe_result_t::NO_FIX;
 
-        if (movement_.detector.detected()) {
-            // Movement detected, go to live tracking.
-            logger::info("Movement detected using movement detector.");
-            movement = true;
+        handle_no_gps_fix(now, &result);
+
+        if (result == probe_result_t::NO_FIX) {
+            return;
         }
 
-        if (now >= gps_.next_probe_time) {
-            probe_result_t result = probe_gps(now);
+        if (state_ == state_t::TRACKING) {
+            if (result != probe_result_t::UNKNOWN) {
+                gps_.idle_probes.push(result == probe_result_t::IDLE);
+            }
 
-            handle_no_gps_fix(now, &result);
+            if (start_gps_batching()) {
+                // The module probes by itself until the next location message.
+                return;
+            }
 
-            if (result != probe_result_t::NO_FIX) {
-                gps_.instance.sleep();
-                gps_.next_probe_time = now + POWER_SAVE_GPS_PROBE_DELAY;
+            uint32_t delay = battery_delay(tracking_probe_delay(result));
+            scheduler_.schedule(task_t::GPS_PROBE, now + delay);
 
+            if (delay >= profile_t::TRACKING_GPS_SLEEP_DELAY) {
+                sleep_gps();
+            }
+        } else {
+            scheduler_.schedule(
+                task_t::GPS_PROBE, now + battery_delay(settings_.power_save_probe_delay));
+            sleep_gps();
+
+            if (result == probe_result_t::IDLE) {
+                if (has_fix && !moved_since_last_msg()) {
+                    // The location did not change, only tells the backend the tracker is alive.
+                    scheduler_.schedule(task_t::HEARTBEAT_MSG, now);
+                } else {
+                    // Moved slowly, or moved and parked again since the previous probe. Without
+                    // a fix, sends a heartbeat unless there is a newer location.
+                    scheduler_.schedule(task_t::LOCATION_MSG, now);
+                }
+            } else {
                 // Sends the coordinates ASAP.
-                radio_.next_msg_time = now;
+                scheduler_.schedule(task_t::LOCATION_MSG, now);
 
-                if (result != probe_result_t::IDLE) {
-                    logger::info("Movement detected using GPS.");
-                    movement = true;
-                }
+                logger::info("Movement detected using GPS.");
+                scheduler_.schedule(task_t::MOVEMENT, now);
             }
         }
+    }
 
-        if (radio_.next_msg_time.has_value() && now >= *radio_.next_msg_time) {
-            bool success = send_location_msg(now);
-
-            if (success) {
-                radio_.next_msg_time = etl::nullopt;
-            } else {
-                radio_.next_msg_time = now + RADIO_RETRY_DELAY;
-            }
+    // Sends the location, and schedules the next periodic message if in TRACKING.
+    void run_location_msg(uint32_t now)
+    {
+        if (gps_.instance.batching()) {
+            read_gps_batch();
         }
 
-        if (movement) {
-            to_tracking(now);
-        } else {
-            sleep(now);
+        send_result_t result = send_location_msg(now);
+
+        if (result != send_result_t::SENT) {
+            scheduler_.schedule(task_t::LOCATION_MSG, retry_time(result, now));
+        } else if (state_ == state_t::TRACKING) {
+            scheduler_.schedule(task_t::LOCATION_MSG, now + battery_delay(settings_.radio_delay));
+
+            // Keeps the trip across resets, sparing the flash endurance.
+            if (!saved_at_.has_value() || now - *saved_at_ >= TRACKING_SAVE_DELAY) {
+                save_state(now);
+            }
         }
     }
 
-    void to_tracking(uint32_t now)
+    // Starts a new trip, unless resuming the current one after a reset.
+    void to_tracking(uint32_t now, bool new_trip = true)
     {
         logger::info("Entering live tracking state");
+        led_activity.notify(led_event_t::TRACKING);
 
         state_ = state_t::TRACKING;
 
+        zones_.parked_in = etl::nullopt;
+        scheduler_.cancel(task_t::HEARTBEAT_MSG);
+
+        if (new_trip) {
+            trip_.current = trip_t{};
+            trip_.current.started_at = now;
+        }
+
         gps_.instance.wake_up();
-        gps_.next_probe_time = now;
+        scheduler_.schedule(task_t::GPS_PROBE, now);
         gps_.idle_probes.clear();
-        gps_.n_idle = 0;
 
-        if (radio_.next_msg_time.has_value()) {
-            radio_.next_msg_time = min(*radio_.next_msg_time, now + TRACKING_RADIO_FIRST_DELAY);
-        } else {
-            radio_.next_msg_time = now + TRACKING_RADIO_FIRST_DELAY;
-        }
+        uint32_t next_msg_time = min(
+            scheduler_.time(task_t::LOCATION_MSG).value_or(UINT32_MAX),
+            now + profile_t::TRACKING_RADIO_FIRST_DELAY);
 
-        // Check there is at least `TRACKING_RADIO_DELAY` since the last message.
+        // Check there is at least the TRACKING radio delay since the last message.
         if (radio_.last_msg_time.has_value()) {
-            radio_.next_msg_time = max(
-                radio_.next_msg_time,
-                *radio_.last_msg_time + TRACKING_RADIO_DELAY);
+            next_msg_time = max(
+                next_msg_time, *radio_.last_msg_time + battery_delay(settings_.radio_delay));
         }
 
+        scheduler_.schedule(task_t::LOCATION_MSG, next_msg_time);
+
         movement_.detector.disable();
+        movement_.detector.reset(now);
+
+        save_state(now);
     }
 
     void to_power_save(uint32_t now)
     {
         logger::info("Entering power save state");
+        led_activity.notify(led_event_t::POWER_SAVE);
+
+        // The measures since boot, if built with `BIKE_TRACKER_BENCHMARK`.
+        benchmark::print(Serial);
 
         state_ = state_t::POWER_SAVE;
 
-        gps_.instance.sleep();
+        if (gps_.instance.batching()) {
+            read_gps_batch();
+            gps_.instance.stop_batching();
+        }
+
+        if constexpr (profile_t::PROBE_LOG_PERSISTENT) {
+            if (radio_.backlog_time.has_value()) {
+                FlashStorageClass<probe_log_t::snapshot_t> storage = probe_log_storage();
+                gps_.log.save(storage, clock_offset_);
+            }
+        }
+
+        end_trip(now);
+
+        zones_.parked_in = parking_zone(now);
+        schedule_power_save(now);
+
+        save_state(now);
 
-        if (gps_.has_position) {
-            gps_.next_probe_time = gps_.last_position_time + POWER_SAVE_GPS_PROBE_DELAY;
+        energy::log();
+    }
+
+    // Schedules the POWER_SAVE probes, or heartbeats if parked in a zone, and waits for movements.
+    void schedule_power_save(uint32_t now)
+    {
+        if (zones_.parked_in.has_value()) {
+            // Relies on the movement detector only.
+            logger::info("Parked in zone ", *zones_.parked_in, ", suspending GPS probes");
+
+            scheduler_.cancel(task_t::GPS_PROBE);
+            scheduler_.schedule(
+                task_t::HEARTBEAT_MSG,
+                now + battery_delay(profile_t::POWER_SAVE_ZONE_HEARTBEAT_DELAY));
+        } else if (gps_.has_position) {
+            scheduler_.schedule(
+                task_t::GPS_PROBE,
+                gps_.last_position_time + battery_delay(settings_.power_save_probe_delay));
         } else {
-            gps_.next_probe_time = now + GPS_RETRY_DELAY;
+            scheduler_.schedule(task_t::GPS_PROBE, now + profile_t::GPS_RETRY_DELAY);
         }
 
-        movement_.detector.reset();
+        sleep_gps();
+
+        movement_.detector.reset(now);
         movement_.detector.enable();
     }
 
-    // Sleep into a low power sleep mode until the next GPS or radio event.
+    void save_state(uint32_t now)
+    {
+        snapshot_t snapshot{};
+
+        snapshot.time = now;
+        snapshot.state = state_;
+
+        snapshot.has_clock_offset = clock_offset_.has_value();
+        snapshot.clock_offset = clock_offset_.value_or(0);
+
+        snapshot.has_position = gps_.has_position;
+        snapshot.last_coordinates = gps_.last_position.coordinates;
+        snapshot.last_position_time = gps_.last_position_time;
+
+        snapshot.distance = gps_.distance;
+        snapshot.alt_gain = gps_.alt_gain;
+        snapshot.moving_time = gps_.moving_time;
+
+        snapshot.has_last_msg_time = radio_.last_msg_time.has_value();
+        snapshot.last_msg_time = radio_.last_msg_time.value_or(0);
+        snapshot.has_last_downlink_time = radio_.last_downlink_time.has_value();
+        snapshot.last_downlink_time = radio_.last_downlink_time.value_or(0);
+        snapshot.quota_window_start = radio_.quota_window_start;
+        snapshot.n_uplinks = radio_.n_uplinks;
+        snapshot.n_downlinks = radio_.n_downlinks;
+
+        snapshot.trip = trip_.current;
+        snapshot.has_ended_trip = trip_.ended.has_value();
+        snapshot.ended_trip = trip_.ended.value_or(trip_t{});
+        snapshot.next_trip_id = trip_.next_id;
+
+        snapshot.gps_probe_delay = settings_.gps_probe_delay;
+        snapshot.radio_delay = settings_.radio_delay;
+        snapshot.power_save_probe_delay = settings_.power_save_probe_delay;
+        snapshot.idle_probes = settings_.idle_probes;
+        snapshot.still_delay = settings_.still_delay;
+        snapshot.has_forced_tracking = settings_.forced_tracking_until.has_value();
+        snapshot.forced_tracking_until = settings_.forced_tracking_until.value_or(0);
+
+        for (size_t i = 0; i < profile_t::POWER_SAVE_ZONES; ++i) {
+            snapshot.has_zone[i] = zones_.table[i].has_value();
+            snapshot.zones[i] = zones_.table[i].value_or(zone_t{});
+        }
+
+        state_store_.save(snapshot);
+        saved_at_ = now;
+    }
+
+    // Restores the state saved before the last reset, if any, and resumes it. Returns false if
+    // there is no saved state.
+    bool restore_state()
+    {
+        snapshot_t snapshot;
+        if (!state_store_.restore(&snapshot)) {
+            return false;
+        }
+
+        // The RTC keeps running across resets (e.g. by the watchdog), but restarts at 0 when the
+        // board loses power. It then restarts from the saved time, until corrected by the GPS.
+        uint32_t now = clock_.getY2kEpoch();
+        bool has_time = now >= snapshot.time;
+
+        if (!has_time) {
+            now = snapshot.time + 1;
+            clock_.setY2kEpoch(now);
+        }
+
+        logger::info(
+            "Restoring the ", snapshot.state == state_t::TRACKING ? "tracking" : "power save",
+            " state saved at ", snapshot.time, has_time ? "" : " (RTC lost)");
+
+        if (snapshot.has_clock_offset) {
+            clock_offset_ = snapshot.clock_offset;
+        }
+
+        if (snapshot.has_position) {
+            // Without the time elapsed since, the position would only skew the next speed. The
+            // progress of a trip since the last save is measured from its last position, if any.
+            bool in_trip = snapshot.last_position_time >= snapshot.trip.started_at;
+
+            if (has_time && (snapshot.state == state_t::POWER_SAVE || in_trip)) {
+                gps_.has_position = true;
+                gps_.last_position = gps_t::position_t{};
+                gps_.last_position.coordinates = snapshot.last_coordinates;
+                gps_.last_position_time = snapshot.last_position_time;
+            }
+
+            etl::optional<uint32_t> gps_time;
+            if (has_time && clock_offset_.has_value()) {
+                gps_time = now + *clock_offset_;
+            }
+
+            gps_.instance.assist(snapshot.last_coordinates, gps_time);
+        }
+
+        gps_.distance = snapshot.distance;
+        gps_.alt_gain = snapshot.alt_gain;
+        gps_.moving_time = snapshot.moving_time;
+
+        if (snapshot.has_last_msg_time) {
+            radio_.last_msg_time = snapshot.last_msg_time;
+        }
+        if (snapshot.has_last_downlink_time) {
+            radio_.last_downlink_time = snapshot.last_downlink_time;
+        }
+        radio_.quota_window_start = snapshot.quota_window_start;
+        radio_.n_uplinks = snapshot.n_uplinks;
+        radio_.n_downlinks = snapshot.n_downlinks;
+
+        trip_.next_id = snapshot.next_trip_id;
+        if (snapshot.has_ended_trip) {
+            trip_.ended = snapshot.ended_trip;
+            scheduler_.schedule(task_t::TRIP_MSG, now);
+        }
+
+        settings_.gps_probe_delay = snapshot.gps_probe_delay;
+        settings_.radio_delay = snapshot.radio_delay;
+        settings_.power_save_probe_delay = snapshot.power_save_probe_delay;
+        settings_.idle_probes = snapshot.idle_probes;
+        settings_.still_delay = snapshot.still_delay;
+        if (snapshot.has_forced_tracking) {
+            settings_.forced_tracking_until = snapshot.forced_tracking_until;
+        }
+
+        for (size_t i = 0; i < profile_t::POWER_SAVE_ZONES; ++i) {
+            if (snapshot.has_zone[i]) {
+                zones_.table[i] = snapshot.zones[i];
+            }
+        }
+
+        if (snapshot.state == state_t::POWER_SAVE) {
+            // Resumes without the side effects of entering POWER_SAVE (the trip already ended).
+            state_ = state_t::POWER_SAVE;
+            zones_.parked_in = parking_zone(now);
+            schedule_power_save(now);
+        } else {
+            trip_.current = snapshot.trip;
+            to_tracking(now, false);
+        }
+
+        return true;
+    }
+
+    // Sleep into a low power sleep mode until the next scheduled task, woken up by an RTC alarm.
     //
     // Wake up on movement detection if movement detector is enabled.
-    void sleep(uint32_t now)
+    void sleep()
     {
-        uint32_t next_event = gps_.next_probe_time;
-        if (radio_.next_msg_time.has_value()) {
-            next_event = min(next_event, *radio_.next_msg_time);
+        // The tasks might have taken some time since the beginning of the loop.
+        uint32_t now = clock_.getY2kEpoch();
+
+        // Parked zones suspend the GPS probes, and the GPS module batches them in TRACKING, but a
+        // message is then scheduled. Should nothing be, probes again after the POWER_SAVE delay
+        // instead of only waking up on a movement.
+        if (!scheduler_.next_time().has_value()) {
+            logger::warning("No scheduled task, scheduling a GPS probe.");
+            scheduler_.schedule(
+                task_t::GPS_PROBE, now + battery_delay(settings_.power_save_probe_delay));
         }
 
-        unsigned long duration = max(500, (next_event - now) * 1000); // min 500ms
+        uint32_t next_event = *scheduler_.next_time();
 
-        logger::info("Sleep for " + String(duration) + " ms");
-        led_t::blue.off();
+        if (next_event <= now) {
+            // Late, runs the next task right away.
+            return;
+        }
+
+        logger::info("Sleep for ", next_event - now, " s");
+        led_activity.asleep();
+
+        energy::stop(energy::subsystem_t::MCU_AWAKE);
+        watchdog::stop();
 
         if (!DEBUG) {
-            LowPower.sleep(duration);
+            clock_.setAlarmEpoch(Y2K_UNIX_EPOCH + next_event);
+            clock_.enableAlarm(RTCZero::MATCH_YYMMDDHHMMSS);
+
+            // The alarm does not fire if the RTC reached it before it was enabled. The interrupts
+            // are masked from the check to the sleep, so that an alarm firing in between is kept
+            // pending, and still ends the sleep. Its handler then runs once they are unmasked.
+            __disable_irq();
+            if (clock_.getY2kEpoch() < next_event) {
+                LowPower.sleep();
+            }
+            __enable_irq();
+
+            clock_.disableAlarm();
+
+            energy::add(energy::subsystem_t::MCU_SLEEP, (clock_.getY2kEpoch() - now) * 1000);
         } else {
-            delay(duration);
+            delay((next_event - now) * 1000);
         }
 
-        led_t::blue.off();
+        watchdog::start(TASK_TIMEOUT);
+
         logger::info("Sleep ended");
     }
 
+    // Corrects the RTC drift using the GPS time, so that the tasks run on schedule.
+    void discipline_clock(const gps_t::date_time_t &date_time)
+    {
+        if (!date_time.has_date || !date_time.has_time || !date_time.is_resolved) {
+            return;
+        }
+
+        uint32_t gps_time = gps_t::y2k_epoch(date_time);
+        uint32_t rtc_time = clock_.getY2kEpoch();
+
+        if (!clock_offset_.has_value()) {
+            clock_offset_ = gps_time - rtc_time;
+            return;
+        }
+
+        int32_t drift = (int32_t) (rtc_time - (gps_time - *clock_offset_));
+
+        if (abs(drift) > CLOCK_MAX_DRIFT) {
+            logger::info("Correcting the RTC drift (", drift, " s)");
+            clock_.setY2kEpoch(rtc_time - drift);
+        }
+    }
+
     // Tries to get the current position.
     probe_result_t probe_gps(unsigned long now)
     {
+        benchmark::scope_t scope(benchmark::stage_t::GPS_PROBE);
+
+        bool had_fix = gps_.instance.ttff().has_value();
+
         gps_t::position_t position = gps_.instance.get_position();
 
+        // Blinks the first fix after each power up of the module.
+        if (!had_fix && gps_.instance.ttff().has_value()) {
+            led_activity.notify(led_event_t::FIX);
+        }
+
+        probe_result_t result = process_position(position, now);
+
+        if (result != probe_result_t::NO_FIX) {
+            discipline_clock(position.date_time);
+        }
+
+        return result;
+    }
+
+    // Lets the GPS module batch the TRACKING probes, if the profile enables it (see
+    // `TRACKING_GPS_BATCHING`). Returns true if the module batches them.
+    bool start_gps_batching()
+    {
+        if constexpr (profile_t::TRACKING_GPS_BATCHING) {
+            if (!gps_.instance.batching()) {
+                gps_.instance.start_batching(battery_delay(settings_.gps_probe_delay));
+            }
+
+            return gps_.instance.batching();
+        } else {
+            return false;
+        }
+    }
+
+    // Processes the probes batched by the GPS module since the previous call, as if they had been
+    // probed at the RTC time matching their GPS time.
+    void read_gps_batch()
+    {
+        size_t n_read = gps_.instance.read_batch([this](const gps_t::position_t &position) {
+            // The time of the probe is unknown until the RTC has been matched with the GPS time.
+            if (
+                !position.has_gnss_fix || !position.date_time.is_resolved ||
+                !clock_offset_.has_value()
+            ) {
+                return;
+            }
+
+            uint32_t time = gps_t::y2k_epoch(position.date_time) - *clock_offset_;
+
+            if (gps_.has_position && (int32_t) (time - gps_.last_position_time) <= 0) {
+                return;
+            }
+
+            probe_result_t result = process_position(position, time);
+
+            if (result != probe_result_t::NO_FIX && result != probe_result_t::UNKNOWN) {
+                gps_.idle_probes.push(result == probe_result_t::IDLE);
+            }
+        });
+
+        logger::info(n_read, " batched GPS probe(s) read");
+    }
+
+    // Updates the tracking state (filtered position, distance, speed, heading) with the position
+    // probed at `now`.
+    probe_result_t process_position(gps_t::position_t position, uint32_t now)
+    {
         bool success = position.has_gnss_fix && position.n_satellites > 0;
 
         if (success) {
             logger::info("New GPS probe");
-            logger::info(
-                "\tLat.: " + String(position.coordinates.lat, 6) + " - " +
-                "Long.: " + String(position.coordinates.lng, 6) + " - " +
-                "Alt.: " + String(position.coordinates.alt, 2) + "m - " +
-                "Sats: " + String(position.n_satellites));
+            if constexpr (logger::LEVEL >= logger::level_t::INFO) {
+                logger::info(
+                    "\tLat.: ", logger::fixed(position.coordinates.lat_degrees(), 6), " - ",
+                    "Long.: ", logger::fixed(position.coordinates.lng_degrees(), 6), " - ",
+                    "Alt.: ", logger::fixed(position.coordinates.alt_meters(), 2), "m - ",
+                    "Sats: ", position.n_satellites, " - ",
+                    "hAcc: ", logger::fixed(position.h_acc, 1), "m");
+            }
+
+            if (!gps_.filter.update(now, position.coordinates, position.h_acc)) {
+                return probe_result_t::NO_FIX;
+            }
+
+            // Distances, altitude gains and idle probes are computed on the filtered positions,
+            // for the GPS noise not to add up.
+            position.coordinates = gps_.filter.coordinates();
 
             probe_result_t result;
 
@@ -319,17 +895,9 @@ private:
 
                 float speed = dist / delta_secs_fp;
 
-                float alt_gain;
-                {
-                    float smoothed_alt =
-                        gps_.smoothed_alt * (1.0f - GPS_ALT_SMOOTHER_FACTOR) +
-                        position.coordinates.alt * GPS_ALT_SMOOTHER_FACTOR;
-
-                    alt_gain =
-                        smoothed_alt > gps_.smoothed_alt ?
-                        smoothed_alt - gps_.smoothed_alt :
-                        0;
-                }
+                float alt_gain = max(
+                    position.coordinates.alt_meters() - gps_.last_position.coordinates.alt_meters(),
+                    0.0f);
 
                 bool is_idle;
                 {
@@ -338,14 +906,33 @@ private:
                         position.coordinates, gps_.last_position.coordinates, true);
                     float horiz_speed = horiz_dist / delta_secs_fp;
 
-                    is_idle = horiz_speed < IDLE_THRESHOLD;
+                    is_idle = horiz_speed < profile_t::IDLE_THRESHOLD;
+
+                    gps_.speed = horiz_speed;
+                }
+
+                if (is_idle) {
+                    // The heading is mostly GPS noise when not moving.
+                    gps_.heading = etl::nullopt;
+                    gps_.heading_change = 0;
+                } else {
+                    float heading = gps_t::bearing(
+                        gps_.last_position.coordinates, position.coordinates);
+
+                    if (gps_.heading.has_value()) {
+                        gps_.heading_change = gps_t::angle_between(*gps_.heading, heading);
+                    } else {
+                        gps_.heading_change = 0;
+                    }
+
+                    gps_.heading = heading;
                 }
 
                 logger::info(
-                    "\tDistance: " + String(dist, 2) + "m - " +
-                    "Speed: " + String(speed, 2) + "m/s  - " +
-                    "Alt. gain: " + String(alt_gain, 2) + "m - " +
-                    "Idle: " + String(is_idle));
+                    "\tDistance: ", logger::fixed(dist, 2), "m - ",
+                    "Speed: ", logger::fixed(speed, 2), "m/s  - ",
+                    "Alt. gain: ", logger::fixed(alt_gain, 2), "m - ",
+                    "Idle: ", is_idle);
 
                 if (is_idle) {
                     result = probe_result_t::IDLE;
@@ -354,10 +941,14 @@ private:
                     gps_.alt_gain += alt_gain;
                     gps_.moving_time += delta_secs;
 
+                    trip_.current.distance += dist;
+                    trip_.current.alt_gain += alt_gain;
+                    trip_.current.moving_time += delta_secs;
+                    trip_.current.max_speed = max(trip_.current.max_speed, gps_.speed);
+
                     result = probe_result_t::MOVING;
                 }
             } else {
-                gps_.smoothed_alt = position.coordinates.alt;
                 result = probe_result_t::UNKNOWN;
             }
 
@@ -365,6 +956,8 @@ private:
             gps_.last_position = position;
             gps_.last_position_time = now;
 
+            gps_.log.push(now, position.coordinates);
+
             return result;
         } else {
             logger::warning("Unsuccessful GPS probe.");
@@ -372,13 +965,54 @@ private:
         }
     }
 
+    // Returns the delay until the next GPS probe in the TRACKING state, based on the result of the
+    // current probe.
+    uint32_t tracking_probe_delay(probe_result_t result)
+    {
+        if (result != probe_result_t::MOVING) {
+            return settings_.gps_probe_delay;
+        }
+
+        if (gps_.heading_change >= profile_t::TRACKING_GPS_TURN_ANGLE) {
+            return profile_t::TRACKING_GPS_PROBE_MIN_DELAY;
+        }
+
+        float delay = profile_t::TRACKING_GPS_PROBE_DISTANCE / gps_.speed;
+
+        // Linearly shortens the delay as the bike starts turning.
+        delay *= 1.0f - gps_.heading_change / profile_t::TRACKING_GPS_TURN_ANGLE;
+
+        uint32_t max_delay =
+            gps_.last_position.n_satellites >= profile_t::TRACKING_GPS_MIN_SATELLITES ?
+            profile_t::TRACKING_GPS_PROBE_MAX_DELAY :
+            settings_.gps_probe_delay;
+
+        return constrain((uint32_t) delay, profile_t::TRACKING_GPS_PROBE_MIN_DELAY, max_delay);
+    }
+
+    // Powers off the GPS until the next probe, having it waking up by itself `GPS_WAKE_UP_LEAD`
+    // seconds before.
+    void sleep_gps()
+    {
+        // The radio might have been used since the beginning of the loop.
+        uint32_t now = clock_.getY2kEpoch();
+        uint32_t next_probe_time = scheduler_.time(task_t::GPS_PROBE).value_or(now);
+        uint32_t delay = next_probe_time > now ? next_probe_time - now : 0;
+
+        if (delay > profile_t::GPS_WAKE_UP_LEAD) {
+            gps_.instance.sleep((delay - profile_t::GPS_WAKE_UP_LEAD) * 1000);
+        } else {
+            gps_.instance.sleep();
+        }
+    }
+
     // Reschedules a new GPS probe if required, and overrides NO_FIX probes when the number of
     // retries is exceeded.
     void handle_no_gps_fix(unsigned long now, probe_result_t *result)
     {
         if (*result == probe_result_t::NO_FIX) {
-            if (gps_.n_retries < GPS_MAX_RETRIES) {
-                gps_.next_probe_time = now + GPS_RETRY_DELAY;
+            if (gps_.n_retries < profile_t::GPS_MAX_RETRIES) {
+                scheduler_.schedule(task_t::GPS_PROBE, now + profile_t::GPS_RETRY_DELAY);
                 ++gps_.n_retries;
             } else {
                 // Number of retries exceeded. Now considers NO_FIX as IDLE probes.
@@ -389,36 +1023,570 @@ private:
         }
     }
 
-    bool send_location_msg(uint64_t now)
+    // Sends the message, requesting a downlink if one is due, and applies the configuration
+    // command of the callback response, if any.
+    //
+    // Returns `QUOTA_REACHED` without sending anything if the daily uplinks quota is reached.
+    template<typename msg_t>
+    send_result_t send(const msg_t &msg, uint32_t now)
     {
-        logger::info("Send location message");
+        if (now - radio_.quota_window_start >= radio_t::QUOTA_WINDOW) {
+            radio_.quota_window_start = now;
+            radio_.n_uplinks = 0;
+            radio_.n_downlinks = 0;
+        }
+
+        if (radio_.n_uplinks >= profile_t::RADIO_DAILY_UPLINKS) {
+            logger::warning("Daily uplinks quota reached.");
+            return send_result_t::QUOTA_REACHED;
+        }
+
+        // A failed downlink request is not retried before the next one is due, as listening for
+        // the downlink is the most expensive part of a message.
+        bool request_downlink = downlink_due(now);
+
+        if (request_downlink) {
+            radio_.last_downlink_time = now;
+            radio_.n_msgs_since_downlink = 0;
+        } else {
+            ++radio_.n_msgs_since_downlink;
+        }
+
+        watchdog::feed(request_downlink ? DOWNLINK_TIMEOUT : TASK_TIMEOUT);
+        etl::optional<uint64_t> response = radio_.instance.send(msg, request_downlink);
+
+        led_activity.notify(
+            response.has_value() ? led_event_t::UPLINK : led_event_t::UPLINK_FAILED);
+
+        if (!response.has_value()) {
+            return send_result_t::FAILED;
+        }
+
+        ++radio_.n_uplinks;
+        if (request_downlink) {
+            ++radio_.n_downlinks;
+        }
+
+        logger::info(
+            "\tQuotas: ", radio_.n_uplinks, "/", profile_t::RADIO_DAILY_UPLINKS, " uplinks - ",
+            radio_.n_downlinks, "/", profile_t::RADIO_DAILY_DOWNLINKS, " downlinks");
+
+        etl::optional<radio_t::config_cmd_t> cmd = radio_t::config_cmd_t::decode(*response);
+        if (cmd.has_value()) {
+            apply_config(*cmd, now);
+        }
+
+        etl::optional<radio_t::zone_cmd_t> zone_cmd = radio_t::zone_cmd_t::decode(*response);
+        if (zone_cmd.has_value()) {
+            apply_zone(*zone_cmd, now);
+        }
+
+        if (cmd.has_value() || zone_cmd.has_value()) {
+            save_state(now);
+        }
+
+        return send_result_t::SENT;
+    }
+
+    // Retries a message that could not be sent after `RADIO_RETRY_DELAY`, or once the quota
+    // window ends if the daily uplinks quota is reached.
+    uint32_t retry_time(send_result_t result, uint32_t now) const
+    {
+        return
+            result == send_result_t::QUOTA_REACHED ?
+            radio_.quota_window_start + radio_t::QUOTA_WINDOW :
+            now + profile_t::RADIO_RETRY_DELAY;
+    }
+
+    void apply_config(const radio_t::config_cmd_t &cmd, uint32_t now)
+    {
+        logger::info("Applying configuration command");
+
+        if (cmd.flags & radio_t::config_cmd_t::CONFIG_RESET) {
+            settings_ = settings_t{};
+        }
 
-        float lat, lng, alt;
+        // The new delays apply from the next scheduled task.
+        if (cmd.gps_probe_delay > 0) {
+            settings_.gps_probe_delay = cmd.gps_probe_delay;
+        }
+        if (cmd.radio_delay > 0) {
+            settings_.radio_delay = cmd.radio_delay * 8;
+        }
+        if (cmd.power_save_delay > 0) {
+            settings_.power_save_probe_delay = cmd.power_save_delay * 60;
+        }
+        if (cmd.idle_probes > 0) {
+            settings_.idle_probes = min(
+                (uint32_t) cmd.idle_probes, profile_t::TRACKING_IDLE_BUFFER_SIZE);
+        }
+        if (cmd.still_delay > 0) {
+            settings_.still_delay = cmd.still_delay * 8;
+        }
+
+        if (cmd.forced_tracking > 0) {
+            settings_.forced_tracking_until = now + cmd.forced_tracking * 60;
+
+            if (state_ == state_t::POWER_SAVE) {
+                scheduler_.schedule(task_t::MOVEMENT, now);
+            }
+        }
+
+        logger::info(
+            "\tGPS probe delay: ", settings_.gps_probe_delay, " s - ",
+            "Radio delay: ", settings_.radio_delay, " s - ",
+            "Power save probe delay: ", settings_.power_save_probe_delay, " s - ",
+            "Idle probes: ", settings_.idle_probes, " - ",
+            "Still delay: ", settings_.still_delay, " s");
+    }
+
+    void apply_zone(const radio_t::zone_cmd_t &cmd, uint32_t now)
+    {
+        if (cmd.slot >= profile_t::POWER_SAVE_ZONES) {
+            logger::warning("Invalid parking zone: ", cmd.slot);
+            return;
+        }
+
+        if (cmd.radius > 0) {
+            zones_.table[cmd.slot] = zone_t{cmd.center, cmd.radius};
+
+            if constexpr (logger::LEVEL >= logger::level_t::INFO) {
+                logger::info(
+                    "Parking zone ", cmd.slot, " set - ",
+                    "Lat.: ", logger::fixed(cmd.center.lat_degrees(), 6), " - ",
+                    "Long.: ", logger::fixed(cmd.center.lng_degrees(), 6), " - ",
+                    "Radius: ", cmd.radius, "m");
+            }
+        } else {
+            zones_.table[cmd.slot] = etl::nullopt;
+
+            logger::info("Parking zone ", cmd.slot, " removed");
+        }
+
+        if (zones_.parked_in.has_value() && *zones_.parked_in == cmd.slot) {
+            // The zone changed under the parked bike, resumes the POWER_SAVE probes.
+            zones_.parked_in = etl::nullopt;
+            scheduler_.cancel(task_t::HEARTBEAT_MSG);
+            scheduler_.schedule(task_t::GPS_PROBE, now);
+        }
+    }
+
+    // Returns the parking zone the latest position is in, if recent enough.
+    etl::optional<size_t> parking_zone(uint32_t now) const
+    {
         if (
-            gps_.has_position &&
-            (!radio_.last_msg_time || gps_.last_position_time > *radio_.last_msg_time)
+            !gps_.has_position ||
+            now - gps_.last_position_time > profile_t::POWER_SAVE_ZONE_MAX_FIX_AGE
+        ) {
+            return etl::nullopt;
+        }
+
+        for (size_t i = 0; i < profile_t::POWER_SAVE_ZONES; ++i) {
+            const etl::optional<zone_t> &zone = zones_.table[i];
+
+            if (
+                zone.has_value() &&
+                gps_t::distance(gps_.last_position.coordinates, zone->center, true) <= zone->radius
+            ) {
+                return i;
+            }
+        }
+
+        return etl::nullopt;
+    }
+
+    // Samples the battery, and updates the battery step.
+    void update_battery(uint32_t now)
+    {
+        constexpr size_t n_steps =
+            sizeof(profile_t::BATTERY_STEP_LEVELS) / sizeof(profile_t::BATTERY_STEP_LEVELS[0]);
+
+        battery_.monitor.update(now);
+
+        uint8_t level = battery_.monitor.level();
+        size_t step = battery_.step;
+
+        while (step < n_steps && level < profile_t::BATTERY_STEP_LEVELS[step]) {
+            ++step;
+        }
+
+        while (
+            step > 0 &&
+            level >= profile_t::BATTERY_STEP_LEVELS[step - 1] + profile_t::BATTERY_STEP_HYSTERESIS
         ) {
-            lat = gps_.last_position.coordinates.lat;
-            lng = gps_.last_position.coordinates.lng;
-            alt = gps_.last_position.coordinates.alt;
+            --step;
+        }
+
+        if (step != battery_.step) {
+            logger::info("Battery at ", level, "%, delays now ", 1 << step, " times longer");
+            battery_.step = step;
+        }
+    }
+
+    // Stretches the delay as the battery drops.
+    uint32_t battery_delay(uint32_t delay) const
+    {
+        return delay << battery_.step;
+    }
+
+    // Returns true if the next message should request a downlink.
+    bool downlink_due(uint32_t now) const
+    {
+        if (radio_.n_downlinks >= profile_t::RADIO_DAILY_DOWNLINKS) {
+            return false;
+        }
+
+        return !radio_.last_downlink_time.has_value() ||
+            now - *radio_.last_downlink_time >= profile_t::RADIO_DOWNLINK_DELAY ||
+            radio_.n_msgs_since_downlink >= profile_t::RADIO_DOWNLINK_MSGS;
+    }
+
+    // Returns true if the backend forces the TRACKING state.
+    bool forced_tracking(uint32_t now) const
+    {
+        return settings_.forced_tracking_until.has_value() &&
+            now < *settings_.forced_tracking_until;
+    }
+
+    // Sends the location, or a heartbeat message if there is no new location.
+    send_result_t send_location_msg(uint64_t now)
+    {
+        benchmark::scope_t scope(benchmark::stage_t::LOCATION_MSG);
+
+        if (!has_location_update()) {
+            logger::info("No new location update.");
+            return send_heartbeat_msg(now);
+        }
+
+        logger::info("Send location message");
+
+        send_result_t result = send(location_msg<location_msg_t>(), now);
+
+        if (result == send_result_t::SENT) {
+            radio_.last_msg_coordinates = gps_.last_position.coordinates;
+            on_location_sent(now);
+        } else if (result == send_result_t::FAILED) {
+            // Retries with the most recent location. Previous probes will be sent as backlog.
+            radio_.backlog_time = now;
+            scheduler_.cancel(task_t::BACKLOG_MSG);
+        }
+
+        return result;
+    }
+
+    // Sends the oldest backlog message, and schedules the next one if any.
+    void run_backlog_msg(uint32_t now)
+    {
+        size_t n_backlog = gps_.log.count_until(*radio_.backlog_time);
+
+        if (n_backlog > 0) {
+            logger::info("Send backlog message (", n_backlog, " remaining probes)");
+
+            size_t n_probes = min(n_backlog, (size_t) profile_t::RADIO_BACKLOG_MSG_PROBES);
+
+            constexpr size_t max_points = radio_t::backlog_msg_t::MAX_POINTS;
+            gps_t::coordinates_t points[max_points];
+            size_t indexes[max_points];
+            size_t n_points = select_probes(0, n_probes, max_points, points, indexes);
+
+            uint32_t last_time = gps_.log[indexes[0]].time;
+            uint32_t interval =
+                n_points > 1 ?
+                (last_time - gps_.log[indexes[n_points - 1]].time) / (n_points - 1) :
+                0;
+
+            // The age of the probes restored after a power loss is only known once the new offset
+            // of the RTC is, and saturated until then.
+            uint32_t age = now - last_time;
+            if (gps_.log.rebased(indexes[0])) {
+                etl::optional<uint32_t> offset = gps_.log.rebased_offset();
+                age = offset.has_value() && clock_offset_.has_value() ?
+                    (now + *clock_offset_) - (last_time + *offset) :
+                    radio_t::backlog_msg_t::UNKNOWN_AGE;
+            }
+
+            radio_t::backlog_msg_t msg{age, interval, points, n_points};
+
+            send_result_t result = send(msg, now);
+
+            if (result == send_result_t::SENT) {
+                gps_.log.pop_front(n_probes);
+                n_backlog -= n_probes;
+            } else {
+                scheduler_.schedule(task_t::BACKLOG_MSG, retry_time(result, now));
+                return;
+            }
+        }
+
+        if (n_backlog > 0) {
+            scheduler_.schedule(task_t::BACKLOG_MSG, now + profile_t::RADIO_BACKLOG_DELAY);
         } else {
-            logger::warning("\tNo new location update.");
-            lat = lng = alt = 0.0f;
+            radio_.backlog_time = etl::nullopt;
         }
+    }
 
-        radio_t::location_msg_t msg{lat, lng, alt, gps_.distance, gps_.alt_gain, gps_.moving_time};
+    // Sends the charge consumed since the previous telemetry message, and schedules the next one.
+    void run_telemetry_msg(uint32_t now)
+    {
+        if constexpr (profile_t::TELEMETRY_ENABLED) {
+            logger::info("Send telemetry message");
+            energy::log();
+
+            float charge[energy::N_SUBSYSTEMS], delta[energy::N_SUBSYSTEMS];
+            for (size_t i = 0; i < energy::N_SUBSYSTEMS; ++i) {
+                charge[i] = energy::charge(static_cast<energy::subsystem_t>(i));
+                delta[i] = charge[i] - telemetry_.last_charge[i];
+            }
 
-        etl::optional<uint64_t> response = radio_.instance.send(msg);
+            radio_t::telemetry_msg_t msg{battery_.monitor.voltage(), delta};
 
-        if (response.has_value()) {
-            gps_.distance = 0.0f;
-            gps_.alt_gain = 0.0f;
-            gps_.moving_time = 0;
+            send_result_t result = send(msg, now);
 
-            radio_.last_msg_time = now;
+            if (result == send_result_t::SENT) {
+                memcpy(telemetry_.last_charge, charge, sizeof(charge));
+                scheduler_.schedule(task_t::TELEMETRY_MSG, now + profile_t::TELEMETRY_DELAY);
+            } else {
+                scheduler_.schedule(task_t::TELEMETRY_MSG, retry_time(result, now));
+            }
         }
+    }
+
+    // Ends the current trip, and sends its summary if the bike moved.
+    void end_trip(uint32_t now)
+    {
+        if (trip_.current.moving_time == 0) {
+            return;
+        }
+
+        if (trip_.ended.has_value()) {
+            logger::warning("Trip ", trip_.ended->id, " summary not sent, dropped.");
+        }
+
+        trip_.current.id = trip_.next_id++;
+        trip_.current.ended_at = now;
+
+        trip_.ended = trip_.current;
+        scheduler_.schedule(task_t::TRIP_MSG, now);
+
+        trip_.current = trip_t{};
+    }
+
+    // Sends the summary of the last ended trip.
+    void run_trip_msg(uint32_t now)
+    {
+        if (!trip_.ended.has_value()) {
+            return;
+        }
+
+        const trip_t &trip = *trip_.ended;
+
+        logger::info(
+            "Send trip message - ",
+            "Trip: ", trip.id, " - ",
+            "Duration: ", trip.ended_at - trip.started_at, " s - ",
+            "Distance: ", logger::fixed(trip.distance, 0), "m - ",
+            "Alt. gain: ", logger::fixed(trip.alt_gain, 0), "m - ",
+            "Moving time: ", trip.moving_time, " s - ",
+            "Max. speed: ", logger::fixed(trip.max_speed, 1), "m/s");
+
+        radio_t::trip_msg_t msg{
+            trip.id, now - trip.ended_at, trip.ended_at - trip.started_at, trip.moving_time,
+            trip.distance, trip.alt_gain, trip.max_speed
+        };
+
+        send_result_t result = send(msg, now);
+
+        if (result == send_result_t::SENT) {
+            trip_.ended = etl::nullopt;
+            save_state(now);
+        } else {
+            scheduler_.schedule(task_t::TRIP_MSG, retry_time(result, now));
+        }
+    }
+
+    // Uses the DEBUG leds policy until `LED_DIAGNOSTIC_DELAY` after the last button press.
+    void start_led_diagnostic(uint32_t now)
+    {
+        logger::info(
+            "Button pressed, leds diagnostic for ", profile_t::LED_DIAGNOSTIC_DELAY, " s");
+
+        if (LED_POLICY != led_policy_t::DEBUG) {
+            led_activity.policy(led_policy_t::DEBUG);
+        }
+        led_activity.awake();
+
+        led_diagnostic_until_ = now + profile_t::LED_DIAGNOSTIC_DELAY;
+        scheduler_.schedule(task_t::LEDS, *led_diagnostic_until_);
+    }
 
-        return response.has_value();
+    // Blinks the pending events, and restores the leds policy at the end of the diagnostic.
+    void run_leds(uint32_t now)
+    {
+        led_activity.blink();
+
+        if (!led_diagnostic_until_.has_value()) {
+            return;
+        }
+
+        if (now >= *led_diagnostic_until_) {
+            logger::info("End of the leds diagnostic");
+            led_activity.policy(LED_POLICY);
+            led_diagnostic_until_ = etl::nullopt;
+        } else {
+            // Blinking the events rescheduled the task.
+            scheduler_.schedule(task_t::LEDS, *led_diagnostic_until_);
+        }
+    }
+
+    // Sends the heartbeat message, and schedules the next one if parked in a zone.
+    void run_heartbeat_msg(uint32_t now)
+    {
+        send_result_t result = send_heartbeat_msg(now);
+
+        if (result != send_result_t::SENT) {
+            scheduler_.schedule(task_t::HEARTBEAT_MSG, retry_time(result, now));
+        } else if (zones_.parked_in.has_value()) {
+            scheduler_.schedule(
+                task_t::HEARTBEAT_MSG,
+                now + battery_delay(profile_t::POWER_SAVE_ZONE_HEARTBEAT_DELAY));
+        }
+    }
+
+    // Sends the tracker status, so that the backend knows it is alive. The probes since the
+    // previous message are considered transmitted, as they did not change the location.
+    send_result_t send_heartbeat_msg(uint32_t now)
+    {
+        logger::info("Send heartbeat message");
+
+        bool tracking = state_ == state_t::TRACKING;
+
+        // `still_for()` clears the detection, which triggers the movements in POWER_SAVE.
+        bool motion =
+            tracking ?
+            movement_.detector.still_for(now) < settings_.still_delay :
+            movement_.detector.detected();
+
+        size_t n_buffered =
+            radio_.backlog_time.has_value() ? gps_.log.count_until(*radio_.backlog_time) : 0;
+
+        radio_t::heartbeat_msg_t msg{
+            tracking, zones_.parked_in.has_value(), motion, n_buffered, battery_.monitor.voltage()
+        };
+
+        send_result_t result = send(msg, now);
+
+        if (result == send_result_t::SENT) {
+            on_location_sent(now);
+        }
+
+        return result;
+    }
+
+    // Returns true if some probes changed the location since the previous message.
+    bool has_location_update() const
+    {
+        if constexpr (etl::is_same<location_msg_t, radio_t::track_msg_t>::value) {
+            size_t first =
+                radio_.backlog_time.has_value() ? gps_.log.count_until(*radio_.backlog_time) : 0;
+
+            return gps_.log.size() > first;
+        } else {
+            return
+                gps_.has_position &&
+                (!radio_.last_msg_time || gps_.last_position_time > *radio_.last_msg_time);
+        }
+    }
+
+    // True if the last probed location is further than `POWER_SAVE_HEARTBEAT_RADIUS` from the
+    // last location sent, or if no location has been sent.
+    bool moved_since_last_msg() const
+    {
+        return
+            !radio_.last_msg_coordinates.has_value() ||
+            gps_t::distance(gps_.last_position.coordinates, *radio_.last_msg_coordinates, true) >
+                profile_t::POWER_SAVE_HEARTBEAT_RADIUS;
+    }
+
+    // Resets the accumulators and the probes since the previous message, and sends the backlog,
+    // if any.
+    void on_location_sent(uint32_t now)
+    {
+        gps_.distance = 0.0f;
+        gps_.alt_gain = 0.0f;
+        gps_.moving_time = 0;
+
+        if (radio_.backlog_time.has_value()) {
+            // Only keeps the probes that could not be transmitted, and sends them next.
+            gps_.log.pop_after(*radio_.backlog_time);
+            scheduler_.schedule(task_t::BACKLOG_MSG, now + profile_t::RADIO_BACKLOG_DELAY);
+        } else {
+            gps_.log.clear();
+        }
+
+        radio_.last_msg_time = now;
+    }
+
+    // Evenly selects up to `max_points` of the logged probes in `[first..last[`, always including
+    // the most recent one.
+    //
+    // Writes the selected coordinates, and their index in the log, the most recent first. Returns
+    // the number of selected probes.
+    size_t select_probes(
+        size_t first, size_t last, size_t max_points,
+        gps_t::coordinates_t *points, size_t *indexes)
+    {
+        size_t n_probes = last - first;
+        size_t n_points = min(n_probes, max_points);
+
+        for (size_t i = 0; i < n_points; ++i) {
+            // The i-th point is `round(i * (n_probes - 1) / (n_points - 1))` probes before the
+            // latest.
+            size_t age = 0;
+            if (i > 0) {
+                age = (2 * i * (n_probes - 1) + n_points - 1) / (2 * (n_points - 1));
+            }
+
+            indexes[i] = last - 1 - age;
+            points[i] = gps_.log[indexes[i]].coordinates;
+        }
+
+        return n_points;
+    }
+
+    // Builds the location message from the probes since the last message.
+    template<typename msg_t>
+    msg_t location_msg()
+    {
+        if constexpr (etl::is_same<msg_t, radio_t::track_msg_t>::value) {
+            // Only sends the probes that are not part of the backlog.
+            size_t first =
+                radio_.backlog_time.has_value() ? gps_.log.count_until(*radio_.backlog_time) : 0;
+
+            constexpr size_t max_points = radio_t::track_msg_t::MAX_POINTS;
+            gps_t::coordinates_t points[max_points];
+            size_t indexes[max_points];
+            size_t n_points = select_probes(first, gps_.log.size(), max_points, points, indexes);
+
+            if (n_points == 0) {
+                logger::warning("\tNo new location update.");
+            }
+
+            return radio_t::track_msg_t{points, n_points};
+        } else {
+            etl::optional<gps_t::coordinates_t> coordinates;
+            if (
+                gps_.has_position &&
+                (!radio_.last_msg_time || gps_.last_position_time > *radio_.last_msg_time)
+            ) {
+                coordinates = gps_.last_position.coordinates;
+            } else {
+                logger::warning("\tNo new location update.");
+            }
+
+            return radio_t::location_msg_t{
+                coordinates, gps_.distance, gps_.alt_gain, gps_.moving_time
+            };
+        }
     }
 };
 
@@ -3,7 +3,9 @@
 
 #include "bike_tracker.hpp"
 
-bike_tracker::bike_tracker_t tracker;
+// Use `bike_tracker::long_tour_profile_t` or `bike_tracker::anti_theft_profile_t` for the other
+// kinds of use (see `profiles.hpp`).
+bike_tracker::bike_tracker_t<bike_tracker::commuter_profile_t> tracker;
 
 void setup()
 {
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <Arduino.h>
+#include <ArduinoLowPower.h>
 
 #include "logger.hpp"
 
@@ -23,15 +24,35 @@ public:
         return digitalRead(pin_num_) == LOW;
     }
 
+    // True if the button has been pressed since the last call, even while the MCU was sleeping.
+    bool was_pressed()
+    {
+        bool was_pressed = pressed_ || pressed();
+        pressed_ = false;
+        return was_pressed;
+    }
+
+    // Also wakes the MCU up when pressed (see `was_pressed()`).
     void setup()
     {
         pinMode(pin_num_, INPUT_PULLUP);
+        LowPower.attachInterruptWakeup(digitalPinToInterrupt(pin_num_), on_press, FALLING);
     }
 
 private:
     pin_size_t pin_num_;
+
+    // Only `a` is wired.
+    static volatile bool pressed_;
+
+    static void on_press()
+    {
+        pressed_ = true;
+    }
 };
 
+volatile bool button_t::pressed_{false};
+
 button_t button_t::a{2};
 
 }
\ No newline at end of file
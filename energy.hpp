@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstdint>
+
+#include <Arduino.h>
+
+#include "logger.hpp"
+
+// Accounts the time each subsystem has been active, and estimates the charge it consumed.
+namespace bike_tracker::energy {
+
+enum class subsystem_t : uint8_t { MCU_AWAKE, MCU_SLEEP, GPS, RADIO_TX, RADIO_RX };
+
+constexpr size_t N_SUBSYSTEMS = 5;
+
+// Estimated current draw of each subsystem while active, in mA.
+constexpr float CURRENT[N_SUBSYSTEMS] = {
+    7.0f,   // MCU_AWAKE: SAMD21 running at 48 MHz.
+    0.05f,  // MCU_SLEEP: SAMD21 in standby, RTC running.
+    25.0f,  // GPS: u-blox M8 tracking, without power save mode.
+    50.0f,  // RADIO_TX: ATA8520 transmitting at 14 dBm.
+    10.0f,  // RADIO_RX: ATA8520 listening for a downlink.
+};
+
+const char *const NAMES[N_SUBSYSTEMS] = { "MCU awake", "MCU sleep", "GPS", "Radio TX", "Radio RX" };
+
+struct counter_t {
+    uint64_t active_ms{0};
+
+    bool running{false};
+    uint32_t started_at{0};
+};
+
+counter_t counters_[N_SUBSYSTEMS];
+
+counter_t &counter(subsystem_t subsystem)
+{
+    return counters_[static_cast<size_t>(subsystem)];
+}
+
+// Milliseconds since boot, including the time spent sleeping (`millis()` does not advance while
+// the MCU sleeps).
+uint32_t now_ms()
+{
+    return millis() + counter(subsystem_t::MCU_SLEEP).active_ms;
+}
+
+// Starts accounting time for the subsystem. Does nothing if already started.
+void start(subsystem_t subsystem)
+{
+    counter_t &c = counter(subsystem);
+
+    if (!c.running) {
+        c.running = true;
+        c.started_at = now_ms();
+    }
+}
+
+void stop(subsystem_t subsystem)
+{
+    counter_t &c = counter(subsystem);
+
+    if (c.running) {
+        c.active_ms += now_ms() - c.started_at;
+        c.running = false;
+    }
+}
+
+// Accounts an activity of a known duration.
+void add(subsystem_t subsystem, uint32_t duration_ms)
+{
+    counter(subsystem).active_ms += duration_ms;
+}
+
+// Returns the time the subsystem has been active since boot, in milliseconds.
+uint64_t active_ms(subsystem_t subsystem)
+{
+    const counter_t &c = counter(subsystem);
+
+    return c.running ? c.active_ms + (now_ms() - c.started_at) : c.active_ms;
+}
+
+// Returns the estimated charge consumed by the subsystem since boot, in mAh.
+float charge(subsystem_t subsystem)
+{
+    return CURRENT[static_cast<size_t>(subsystem)] * (float) active_ms(subsystem) / 3600000.0f;
+}
+
+float total_charge()
+{
+    float total = 0.0f;
+    for (size_t i = 0; i < N_SUBSYSTEMS; ++i) {
+        total += charge(static_cast<subsystem_t>(i));
+    }
+    return total;
+}
+
+// Writes the accounted time and charge of each subsystem to the serial port.
+void log()
+{
+    if constexpr (logger::LEVEL >= logger::level_t::INFO) {
+        logger::info("Energy since boot: ", logger::fixed(total_charge(), 3), " mAh");
+
+        for (size_t i = 0; i < N_SUBSYSTEMS; ++i) {
+            subsystem_t subsystem = static_cast<subsystem_t>(i);
+
+            logger::info(
+                "\t", NAMES[i], ": ", (unsigned long) (active_ms(subsystem) / 1000), " s - ",
+                logger::fixed(charge(subsystem), 3), " mAh");
+        }
+    }
+}
+
+}
@@ -4,7 +4,10 @@
 #include <cmath>
 
 #include <SparkFun_u-blox_GNSS_Arduino_Library.h>
+#include <etl/optional.h>
 
+#include "benchmark.hpp"
+#include "energy.hpp"
 #include "logger.hpp"
 
 namespace bike_tracker {
@@ -23,12 +26,33 @@ public:
         uint8_t hour;
         uint8_t minute;
         uint8_t second;
+
+        // False until the receiver knows the UTC leap seconds, the time might be a few seconds
+        // off until then.
+        bool is_resolved;
     };
 
+    // Coordinates as reported by the receiver. Kept as integers, so that the deltas between
+    // coordinates are exact.
     struct coordinates_t {
-        float lat; // in degrees, [+90..-90]
-        float lng; // in degrees, [+180..-180]
-        float alt; // above sea level in meters
+        int32_t lat; // in 1e-7 degrees, [+90..-90]
+        int32_t lng; // in 1e-7 degrees, [+180..-180]
+        int32_t alt; // above sea level in mm
+
+        float lat_degrees() const
+        {
+            return (float) lat * 1e-7f;
+        }
+
+        float lng_degrees() const
+        {
+            return (float) lng * 1e-7f;
+        }
+
+        float alt_meters() const
+        {
+            return (float) alt * 1e-3f;
+        }
     };
 
     struct position_t {
@@ -37,65 +61,94 @@ public:
 
         coordinates_t coordinates;
 
+        float speed;    // ground speed, in meters per sec
+        float heading;  // heading of motion, in degrees, [0..360[
+        float h_acc;    // horizontal accuracy estimate, in meters
+        float p_dop;    // position dilution of precision
+
         date_time_t date_time;
     };
 
-    gps_t(Uart &serial = Serial1) : serial_(serial)
+    // Returns the `constellations` bit enabling the given GNSS.
+    static constexpr uint8_t constellation(sfe_ublox_gnss_ids_e id)
+    {
+        return 1 << id;
+    }
+
+    // Only enables the GNSS of the `constellations` bits (see `constellation()`).
+    gps_t(uint8_t constellations, Uart &serial = Serial1) :
+        constellations_(constellations), serial_(serial)
     { }
 
+    // If the module does not answer, its configuration is applied on the next wake-up instead.
     void
     setup()
     {
-        serial_.begin(9600);
-        while(!serial_);
-
-        if (!instance_.begin(serial_)) {
-            logger::error("Unable to setup GPS.");
+        if (!begin()) {
+            return;
         }
 
-        powered_on_ = true;
-
-        for (const gnss_config_t &gnss : GNSS_CONFIG) {
-            instance_.enableGNSS(gnss.enabled, gnss.id);
-        }
-
-        power_save(false);
+        // The configuration is saved in the module, wake-ups from the backup mode do not need to
+        // re-apply it.
+        configure();
 
         logger::info("GPS successfuly initialized.");
-
     }
 
+    // Returns a position without fix if the module does not answer.
     position_t get_position()
     {
-        if (!powered_on_) {
-            wake_up();
+        position_t pos{};
+
+        if (!powered_on_ && !wake_up()) {
+            return pos;
+        }
+
+        // Reads every field from a single NAV-PVT frame. The library's getters would poll a new
+        // frame as soon as a field is read twice.
+        if (!instance_.getPVT()) {
+            logger::warning("No NAV-PVT response from GPS.");
+            return pos;
         }
 
-        position_t pos;
+        const UBX_NAV_PVT_data_t &pvt = instance_.packetUBXNAVPVT->data;
+
+        pos.has_gnss_fix = pvt.flags.bits.gnssFixOK;
+        pos.n_satellites = pvt.numSV;
 
-        pos.has_gnss_fix = instance_.getGnssFixOk();
-        pos.n_satellites = instance_.getSIV();
+        if (pos.has_gnss_fix && !ttff_.has_value()) {
+            ttff_ = energy::now_ms() - powered_on_at_;
+            logger::info("GPS fix ", *ttff_, " ms after powering up.");
+        }
 
         if (pos.has_gnss_fix) {
-            pos.coordinates.lat = ((float) instance_.getLatitude()) * 0.0000001f;
-            pos.coordinates.lng = ((float) instance_.getLongitude()) * 0.0000001f;
-            pos.coordinates.alt = ((float) instance_.getAltitudeMSL()) * 0.001f;
+            pos.coordinates = coordinates_t{pvt.lat, pvt.lon, pvt.hMSL};
+
+            pos.speed = ((float) pvt.gSpeed) * 0.001f;
+            pos.heading = ((float) pvt.headMot) * 0.00001f;
+            pos.h_acc = ((float) pvt.hAcc) * 0.001f;
+            pos.p_dop = ((float) pvt.pDOP) * 0.01f;
         }
 
-        pos.date_time.has_date = instance_.getDateValid();
+        pos.date_time.has_date = pvt.valid.bits.validDate;
         if (pos.date_time.has_date) {
-            pos.date_time.year = instance_.getYear();
-            pos.date_time.month = instance_.getMonth();
-            pos.date_time.day = instance_.getDay();
+            pos.date_time.year = pvt.year;
+            pos.date_time.month = pvt.month;
+            pos.date_time.day = pvt.day;
         }
 
-        pos.date_time.has_time = instance_.getTimeValid();
+        pos.date_time.has_time = pvt.valid.bits.validTime;
         if (pos.date_time.has_time) {
-            pos.date_time.hour = instance_.getHour();
-            pos.date_time.minute = instance_.getMinute();
-            pos.date_time.second = instance_.getSecond();
+            pos.date_time.hour = pvt.hour;
+            pos.date_time.minute = pvt.min;
+            pos.date_time.second = pvt.sec;
         }
 
+        pos.date_time.is_resolved = pvt.valid.bits.fullyResolved;
+
+        // Marks the frame as read, so that the getters do not use it.
+        instance_.flushPVT();
+
         return pos;
     }
 
@@ -104,28 +157,64 @@ public:
         return instance_;
     }
 
+    // Time between the last power up and the first fix that followed it, in ms. It is only an
+    // upper bound of the actual time to first fix, as the module is not polled continuously.
+    etl::optional<uint32_t> ttff() const
+    {
+        return ttff_;
+    }
+
     // Power off the GPS module until the next location request or call to `wake_up()`.
-    void sleep()
+    //
+    // The module enters the software backup mode, in which it keeps its configuration and the
+    // satellites data, allowing a hot start if woken up before the ephemeris expire (~4 hours).
+    //
+    // If `wake_up_in` is not 0, the module powers up by itself after this delay (in ms), so that
+    // it already has a fix when the next location is requested. A module already in timed backup
+    // is woken up to reschedule its wake up.
+    void sleep(uint32_t wake_up_in = 0)
     {
+        if (!powered_on_ && wakes_up_at_.has_value()) {
+            wake_up();
+        }
+
         if (powered_on_) {
             logger::info("Powering off GPS");
-            instance_.powerOff(0);
+            instance_.powerOff(wake_up_in);
             powered_on_ = false;
+            batching_ = false;
+            energy::stop(energy::subsystem_t::GPS);
+
+            if (wake_up_in > 0) {
+                wakes_up_at_ = energy::now_ms() + wake_up_in;
+            } else {
+                wakes_up_at_ = etl::nullopt;
+            }
         }
     }
 
-    void wake_up()
+    // Returns false if the module does not answer. It stays powered off until the next wake-up.
+    bool wake_up()
     {
         if (!powered_on_) {
             logger::info("Powering up GPS");
-            setup();
+
+            if (!begin()) {
+                return false;
+            }
+
+            if (!configured_) {
+                configure();
+            }
         }
+
+        return true;
     }
 
     bool power_save()
     {
-        if (!powered_on_) {
-            wake_up();
+        if (!powered_on_ && !wake_up()) {
+            return false;
         }
 
         return instance_.getPowerSaveMode();
@@ -133,18 +222,243 @@ public:
 
     void power_save(bool enabled)
     {
-        if (!powered_on_) {
-            wake_up();
+        if (!powered_on_ && !wake_up()) {
+            return;
         }
 
         instance_.powerSaveMode(enabled);
     }
 
-    // Computes the distance (in meters) between two coordinates.
+    // True if the module can record its fixes by itself while the MCU sleeps (see
+    // `start_batching()`). Batching requires the u-blox M8 protocol 23.01 or later (e.g. not the
+    // SAM-M8Q, running the protocol 18).
+    bool supports_batching()
+    {
+        if (!powered_on_ && !wake_up()) {
+            return false;
+        }
+
+        return instance_.getProtocolVersionHigh() >= BATCHING_PROTOCOL_VERSION;
+    }
+
+    // Makes the module compute a fix every `period` seconds (up to `MAX_BATCH_PERIOD`), in its
+    // cyclic power save mode, and keep the last `BATCH_SIZE` of them (UBX-CFG-BATCH) until they
+    // are read by `read_batch()`. Returns false if the module does not support batching.
+    //
+    // Batching stops when the module is powered off.
+    bool start_batching(uint32_t period)
+    {
+        if (period > MAX_BATCH_PERIOD || !supports_batching()) {
+            return false;
+        }
+
+        instance_.setMeasurementRate(period * 1000);
+        power_save(true);
+
+        if (!configure_batching(true)) {
+            logger::warning("Unable to enable GPS batching.");
+            stop_batching();
+            return false;
+        }
+
+        logger::info("GPS batching every ", period, " s");
+        batching_ = true;
+        return true;
+    }
+
+    void stop_batching()
+    {
+        if (!powered_on_) {
+            return;
+        }
+
+        configure_batching(false);
+        instance_.setMeasurementRate(1000);
+        power_save(false);
+
+        batching_ = false;
+    }
+
+    bool batching() const
+    {
+        return batching_;
+    }
+
+    // Retrieves the fixes batched since the previous call (UBX-LOG-RETRIEVEBATCH), oldest first,
+    // calling `on_position(const position_t &)` on each of them. Returns the number of fixes read.
+    template<typename on_position_t>
+    size_t read_batch(on_position_t on_position)
+    {
+        if (!batching_) {
+            return 0;
+        }
+
+        // Sends the MON-BATCH status first, with the number of batched entries.
+        const uint8_t request[4] = { 0, 0x01, 0, 0 };
+        send_ubx(UBX_CLASS_LOG, UBX_LOG_RETRIEVEBATCH, request, sizeof(request));
+
+        uint8_t payload[LOG_BATCH_SIZE];
+
+        if (!receive_ubx(UBX_CLASS_MON, UBX_MON_BATCH, payload, MON_BATCH_SIZE)) {
+            logger::warning("No MON-BATCH response from GPS.");
+            return 0;
+        }
+
+        uint16_t n_entries = read_u16(payload + 4);
+        uint16_t n_dropped = read_u16(payload + 8);
+
+        if (n_dropped > 0) {
+            logger::warning(n_dropped, " batched GPS fix(es) dropped.");
+        }
+
+        size_t n_read = 0;
+        for (; n_read < n_entries; ++n_read) {
+            if (!receive_ubx(UBX_CLASS_LOG, UBX_LOG_BATCH, payload, LOG_BATCH_SIZE)) {
+                logger::warning("Missing LOG-BATCH entries from GPS.");
+                break;
+            }
+
+            on_position(decode_batch_entry(payload));
+        }
+
+        return n_read;
+    }
+
+    // Returns the number of seconds since 2000-01-01 00:00:00 UTC. The date and time must be valid.
+    static uint32_t y2k_epoch(const date_time_t &date_time)
+    {
+        // Based on http://howardhinnant.github.io/date_algorithms.html#days_from_civil.
+
+        int32_t year = date_time.year - (date_time.month <= 2 ? 1 : 0);
+        uint32_t month = date_time.month;
+
+        int32_t era = year / 400;
+        uint32_t year_of_era = year - era * 400;
+        uint32_t day_of_year =
+            (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + date_time.day - 1;
+        uint32_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+
+        // Days between 0000-03-01 and 2000-01-01.
+        int32_t days = era * 146097 + (int32_t) day_of_era - 730425;
+
+        return days * 86400 + date_time.hour * 3600 + date_time.minute * 60 + date_time.second;
+    }
+
+    // The inverse of `y2k_epoch()`.
+    static date_time_t from_y2k_epoch(uint32_t epoch)
+    {
+        // Based on http://howardhinnant.github.io/date_algorithms.html#civil_from_days.
+
+        uint32_t days = epoch / 86400 + 730425;   // Since 0000-03-01.
+        uint32_t secs = epoch % 86400;
+
+        uint32_t era = days / 146097;
+        uint32_t day_of_era = days - era * 146097;
+        uint32_t year_of_era =
+            (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+        uint32_t day_of_year =
+            day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+        uint32_t mp = (5 * day_of_year + 2) / 153;
+        uint32_t month = mp < 10 ? mp + 3 : mp - 9;
+
+        date_time_t date_time{};
+        date_time.has_date = date_time.has_time = date_time.is_resolved = true;
+        date_time.year = year_of_era + era * 400 + (month <= 2 ? 1 : 0);
+        date_time.month = month;
+        date_time.day = day_of_year - (153 * mp + 2) / 5 + 1;
+        date_time.hour = secs / 3600;
+        date_time.minute = secs / 60 % 60;
+        date_time.second = secs % 60;
+        return date_time;
+    }
+
+    // Gives the module the approximate position, and the UTC time, if known (as a `y2k_epoch()`),
+    // so that it searches the satellites in view first (UBX-MGA-INI-POS_LLH and TIME_UTC).
+    //
+    // Without a valid ephemeris, the module still has to download it from the satellites.
+    void assist(const coordinates_t &coordinates, etl::optional<uint32_t> time)
+    {
+        if (!powered_on_ && !wake_up()) {
+            return;
+        }
+
+        logger::info(
+            "Assisting GPS with the last known ", time.has_value() ? "time and " : "", "position");
+
+        uint8_t pos[20] = { 0x01, 0 };
+        write_u32(pos + 4, coordinates.lat);
+        write_u32(pos + 8, coordinates.lng);
+        write_u32(pos + 12, coordinates.alt / 10); // cm
+        write_u32(pos + 16, ASSIST_POSITION_ACCURACY * 100);
+        send_ubx(UBX_CLASS_MGA, UBX_MGA_INI, pos, sizeof(pos));
+
+        if (time.has_value()) {
+            date_time_t date_time = from_y2k_epoch(*time);
+
+            uint8_t utc[24] = { 0x10, 0, 0, 0x80 };  // unknown leap seconds
+            write_u16(utc + 4, date_time.year);
+            utc[6] = date_time.month;
+            utc[7] = date_time.day;
+            utc[8] = date_time.hour;
+            utc[9] = date_time.minute;
+            utc[10] = date_time.second;
+            write_u16(utc + 16, ASSIST_TIME_ACCURACY);
+            send_ubx(UBX_CLASS_MGA, UBX_MGA_INI, utc, sizeof(utc));
+        }
+    }
+
+    // Computes the distance (in meters) between two coordinates, projecting them on a plane at
+    // their mean latitude (equirectangular approximation).
+    //
+    // The SAMD21 has no FPU: the projection is computed on the integer coordinates, in 1e-7
+    // degrees units, with the cosine of the mean latitude in fixed point. Only the cosine and the
+    // final square root use (single precision) floats. Compared to the haversine formula (see
+    // `haversine_distance()`), the error stays within about 1 cm (the coordinates resolution) for
+    // distances up to 10 km, at latitudes up to 70°.
     //
     // If `ignore_alt` is true, only computes the horizontal distance.
     static float distance(
         const coordinates_t &coord_a, const coordinates_t &coord_b, bool ignore_alt = false)
+    {
+        benchmark::scope_t scope(benchmark::stage_t::DISTANCE);
+
+        // Length of 1e-7 degree of latitude.
+        constexpr float unit_length = 6371.0f * 1000.0f * (float) M_PI / 180.0f * 1e-7f; // m
+        constexpr float to_radians = (float) M_PI / 180.0f;
+
+        // Q30 fixed point.
+        constexpr uint8_t fraction_bits = 30;
+        constexpr int64_t one = 1LL << fraction_bits;
+
+        float mean_lat = (float) (((int64_t) coord_a.lat + coord_b.lat) / 2) * 1e-7f * to_radians;
+        int64_t cos_lat = (int64_t) (cosf(mean_lat) * (float) one);
+
+        // Rounds to the nearest unit.
+        int64_t x = (((int64_t) coord_a.lng - coord_b.lng) * cos_lat + one / 2) >> fraction_bits;
+        int64_t y = (int64_t) coord_a.lat - coord_b.lat;
+
+        // Does not overflow, even for antipodal coordinates.
+        uint64_t abs_x = x < 0 ? -x : x;
+        uint64_t abs_y = y < 0 ? -y : y;
+
+        float horiz_dist = sqrtf((float) (abs_x * abs_x + abs_y * abs_y)) * unit_length;
+
+        if (ignore_alt) {
+            return horiz_dist;
+        } else {
+            float vert_dist = (float) (coord_a.alt - coord_b.alt) * 1e-3f;
+
+            return sqrtf(horiz_dist * horiz_dist + vert_dist * vert_dist);
+        }
+    }
+
+    // Computes the distance (in meters) between two coordinates, using the haversine formula.
+    //
+    // Exact on a spherical Earth, but much slower than `distance()` without an FPU.
+    //
+    // If `ignore_alt` is true, only computes the horizontal distance.
+    static float haversine_distance(
+        const coordinates_t &coord_a, const coordinates_t &coord_b, bool ignore_alt = false)
     {
         // Based on http://www.movable-type.co.uk/scripts/latlong.html.
 
@@ -154,11 +468,11 @@ public:
             return value * M_PI / 180.0f;
         };
 
-        float lat_a = to_radians(coord_a.lat);
-        float lat_b = to_radians(coord_b.lat);
+        float lat_a = to_radians(coord_a.lat_degrees());
+        float lat_b = to_radians(coord_b.lat_degrees());
 
-        float delta_lat = to_radians(coord_a.lat - coord_b.lat);
-        float delta_lng = to_radians(coord_a.lng - coord_b.lng);
+        float delta_lat = to_radians((float) (coord_a.lat - coord_b.lat) * 1e-7f);
+        float delta_lng = to_radians((float) ((int64_t) coord_a.lng - coord_b.lng) * 1e-7f);
 
         float a = pow(sin(delta_lat  / 2), 2)
                 + cos(lat_a) * cos(lat_b) * pow(sin(delta_lng / 2), 2);
@@ -169,35 +483,367 @@ public:
         if (ignore_alt) {
             return horiz_dist;
         } else {
-            float vert_dist = abs(coord_a.alt - coord_b.alt);
+            float vert_dist = abs(coord_a.alt - coord_b.alt) * 1e-3f;
 
             return sqrt(pow(horiz_dist, 2) + pow(vert_dist, 2));
         }
     }
 
+    // Computes the initial bearing (in degrees, [0..360[, clockwise from north) to go from
+    // `coord_a` to `coord_b`.
+    static float bearing(const coordinates_t &coord_a, const coordinates_t &coord_b)
+    {
+        // Based on http://www.movable-type.co.uk/scripts/latlong.html.
+
+        auto to_radians = [](float value) {
+            return value * M_PI / 180.0f;
+        };
+
+        float lat_a = to_radians(coord_a.lat_degrees());
+        float lat_b = to_radians(coord_b.lat_degrees());
+
+        float delta_lng = to_radians((float) ((int64_t) coord_b.lng - coord_a.lng) * 1e-7f);
+
+        float y = sin(delta_lng) * cos(lat_b);
+        float x = cos(lat_a) * sin(lat_b) - sin(lat_a) * cos(lat_b) * cos(delta_lng);
+
+        float bearing = atan2(y, x) * 180.0f / M_PI;
+
+        return bearing < 0 ? bearing + 360.0f : bearing;
+    }
+
+    // Returns the smallest angle (in degrees, [0..180]) between two bearings.
+    static float angle_between(float bearing_a, float bearing_b)
+    {
+        float angle = abs(bearing_a - bearing_b);
+
+        return angle > 180.0f ? 360.0f - angle : angle;
+    }
+
 private:
-    struct gnss_config_t {
-        sfe_ublox_gnss_ids_e id;
-        bool enabled;
-    };
+    // Baud rate of the module when not configured, and the one used after setup.
+    static constexpr uint32_t DEFAULT_BAUD_RATE = 9600;
+    static constexpr uint32_t BAUD_RATE = 115200;
+
+    // Configuration subsections saved in the module's non-volatile memory by `configure()`.
+    static constexpr uint32_t SAVED_CONFIG =
+        VAL_CFG_SUBSEC_IOPORT | VAL_CFG_SUBSEC_MSGCONF | VAL_CFG_SUBSEC_NAVCONF |
+        VAL_CFG_SUBSEC_RXMCONF;
+
+    static const sfe_ublox_gnss_ids_e GNSS_IDS[7];
+
+    static constexpr uint8_t BATCHING_PROTOCOL_VERSION = 23;
+
+    // CFG-RATE measures at most every 65.535 s.
+    static constexpr uint32_t MAX_BATCH_PERIOD = 65; // sec
 
-    static const gnss_config_t GNSS_CONFIG[7];
+    // Fixes kept by the module between two `read_batch()`.
+    static constexpr uint16_t BATCH_SIZE = 64;
+
+    // UBX frames not covered by the library.
+    static constexpr uint8_t UBX_SYNC_1 = 0xb5;
+    static constexpr uint8_t UBX_SYNC_2 = 0x62;
+
+    static constexpr uint8_t UBX_CLASS_ACK = 0x05;
+    static constexpr uint8_t UBX_ACK_ACK = 0x01;
+    static constexpr uint8_t UBX_CLASS_CFG = 0x06;
+    static constexpr uint8_t UBX_CFG_BATCH = 0x93;
+    static constexpr uint8_t UBX_CLASS_MON = 0x0a;
+    static constexpr uint8_t UBX_MON_BATCH = 0x32;
+    static constexpr uint8_t UBX_CLASS_LOG = 0x21;
+    static constexpr uint8_t UBX_LOG_RETRIEVEBATCH = 0x10;
+    static constexpr uint8_t UBX_LOG_BATCH = 0x11;
+    static constexpr uint8_t UBX_CLASS_MGA = 0x13;
+    static constexpr uint8_t UBX_MGA_INI = 0x40;
+
+    static constexpr uint16_t MON_BATCH_SIZE = 12;
+    static constexpr uint16_t LOG_BATCH_SIZE = 100;
+
+    static constexpr uint32_t UBX_TIMEOUT = 1100; // ms
+
+    // The bike might have been moved while the tracker was off, and the RTC drifts.
+    static constexpr uint32_t ASSIST_POSITION_ACCURACY = 10 * 1000;    // meters
+    static constexpr uint16_t ASSIST_TIME_ACCURACY = 10;                // sec
+
+    uint8_t constellations_;
 
     Uart &serial_;
 
     SFE_UBLOX_GNSS instance_;
 
     bool powered_on_{false};
+
+    // True once the configuration has been applied and saved in the module.
+    bool configured_{false};
+
+    uint32_t powered_on_at_{0};
+
+    // True while the module batches its fixes.
+    bool batching_{false};
+
+    // Time at which the module leaves its timed backup mode, if any.
+    etl::optional<uint32_t> wakes_up_at_;
+
+    etl::optional<uint32_t> ttff_;
+
+    // Connects to the module, switching it to `BAUD_RATE` if required. Returns false if the
+    // module does not answer, after at most 3 `UBX_TIMEOUT`.
+    bool begin()
+    {
+        // The module might already use the higher baud rate if it has been configured before.
+        if (!begin(BAUD_RATE)) {
+            if (!begin(DEFAULT_BAUD_RATE)) {
+                logger::error("Unable to setup GPS.");
+                return false;
+            }
+
+            logger::info("Switching GPS to ", BAUD_RATE, " bauds.");
+            instance_.setSerialRate(BAUD_RATE, COM_PORT_UART1);
+
+            if (!begin(BAUD_RATE)) {
+                logger::error("Unable to setup GPS at ", BAUD_RATE, " bauds.");
+                return false;
+            }
+        }
+
+        uint32_t now = energy::now_ms();
+
+        // The module has been running since the end of its timed backup.
+        if (wakes_up_at_.has_value() && (int32_t) (now - *wakes_up_at_) > 0) {
+            energy::add(energy::subsystem_t::GPS, now - *wakes_up_at_);
+            powered_on_at_ = *wakes_up_at_;
+        } else {
+            powered_on_at_ = now;
+        }
+
+        wakes_up_at_ = etl::nullopt;
+        ttff_ = etl::nullopt;
+
+        powered_on_ = true;
+        energy::start(energy::subsystem_t::GPS);
+
+        return true;
+    }
+
+    // Opens the serial port at the given baud rate and returns true if the module answers within
+    // `UBX_TIMEOUT`. Unlike USB serial ports, the UART is ready as soon as it is opened.
+    bool begin(uint32_t baud_rate)
+    {
+        serial_.begin(baud_rate);
+
+        return instance_.begin(serial_, UBX_TIMEOUT);
+    }
+
+    // Enables or disables the batching of the fixes, with the extra PVT fields (UBX-CFG-BATCH).
+    // Returns true if the module acknowledged the configuration.
+    bool configure_batching(bool enabled)
+    {
+        const uint8_t config[8] = {
+            0,                                          // version
+            (uint8_t) (enabled ? 0x01 | 0x04 : 0),      // flags: enable, extraPvt
+            BATCH_SIZE & 0xff, BATCH_SIZE >> 8,         // bufSize
+            0, 0,                                       // notifThrs
+            0, 0,                                       // pioId, reserved
+        };
+
+        send_ubx(UBX_CLASS_CFG, UBX_CFG_BATCH, config, sizeof(config));
+
+        // Skips the late acknowledgements of the previous commands, if any.
+        uint8_t ack[2];
+        while (receive_ubx(UBX_CLASS_ACK, UBX_ACK_ACK, ack, sizeof(ack))) {
+            if (ack[0] == UBX_CLASS_CFG && ack[1] == UBX_CFG_BATCH) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    // Converts a LOG-BATCH entry, with the extra PVT fields.
+    static position_t decode_batch_entry(const uint8_t *entry)
+    {
+        position_t pos{};
+
+        uint8_t valid = entry[15];
+        pos.has_gnss_fix = entry[25] & 0x01;
+        pos.n_satellites = entry[27];
+
+        if (pos.has_gnss_fix) {
+            pos.coordinates = coordinates_t{
+                (int32_t) read_u32(entry + 32), (int32_t) read_u32(entry + 28),
+                (int32_t) read_u32(entry + 40)
+            };
+
+            pos.speed = ((float) (int32_t) read_u32(entry + 64)) * 0.001f;
+            pos.heading = ((float) (int32_t) read_u32(entry + 68)) * 0.00001f;
+            pos.h_acc = ((float) read_u32(entry + 44)) * 0.001f;
+            pos.p_dop = ((float) read_u16(entry + 80)) * 0.01f;
+        }
+
+        pos.date_time.has_date = valid & 0x01;
+        pos.date_time.year = read_u16(entry + 8);
+        pos.date_time.month = entry[10];
+        pos.date_time.day = entry[11];
+
+        pos.date_time.has_time = valid & 0x02;
+        pos.date_time.hour = entry[12];
+        pos.date_time.minute = entry[13];
+        pos.date_time.second = entry[14];
+
+        // Batched fixes have valid times once the leap seconds are known.
+        pos.date_time.is_resolved = pos.date_time.has_date && pos.date_time.has_time;
+
+        return pos;
+    }
+
+    static uint16_t read_u16(const uint8_t *data)
+    {
+        return data[0] | (data[1] << 8);
+    }
+
+    static uint32_t read_u32(const uint8_t *data)
+    {
+        return read_u16(data) | ((uint32_t) read_u16(data + 2) << 16);
+    }
+
+    static void write_u16(uint8_t *data, uint16_t value)
+    {
+        data[0] = value & 0xff;
+        data[1] = value >> 8;
+    }
+
+    static void write_u32(uint8_t *data, uint32_t value)
+    {
+        write_u16(data, value & 0xffff);
+        write_u16(data + 2, value >> 16);
+    }
+
+    // Writes a UBX frame to the module.
+    void send_ubx(uint8_t cls, uint8_t id, const uint8_t *payload, uint16_t size)
+    {
+        const uint8_t header[6] = {
+            UBX_SYNC_1, UBX_SYNC_2, cls, id, (uint8_t) (size & 0xff), (uint8_t) (size >> 8)
+        };
+
+        uint8_t ck_a = 0, ck_b = 0;
+        auto checksum = [&](const uint8_t *data, size_t n) {
+            for (size_t i = 0; i < n; ++i) {
+                ck_a += data[i];
+                ck_b += ck_a;
+            }
+        };
+        checksum(header + 2, sizeof(header) - 2);
+        checksum(payload, size);
+
+        const uint8_t footer[2] = { ck_a, ck_b };
+
+        serial_.write(header, sizeof(header));
+        serial_.write(payload, size);
+        serial_.write(footer, sizeof(footer));
+    }
+
+    // Reads the UBX frames sent by the module until one with the given class and ID, skipping the
+    // others. Returns false if no valid frame of at most `max_size` bytes has been received within
+    // `UBX_TIMEOUT`.
+    bool receive_ubx(uint8_t cls, uint8_t id, uint8_t *payload, uint16_t max_size)
+    {
+        uint32_t started_at = millis();
+
+        // Reads the next byte, waiting for it. Returns -1 on timeout.
+        auto read = [&]() -> int {
+            while (serial_.available() == 0) {
+                if (millis() - started_at > UBX_TIMEOUT) {
+                    return -1;
+                }
+                delay(1);
+            }
+            return serial_.read();
+        };
+
+        for (;;) {
+            int c = read();
+            if (c < 0) {
+                return false;
+            } else if (c != UBX_SYNC_1 || read() != UBX_SYNC_2) {
+                continue;
+            }
+
+            uint8_t header[4];
+            for (uint8_t &b : header) {
+                int c = read();
+                if (c < 0) {
+                    return false;
+                }
+                b = c;
+            }
+
+            uint16_t size = header[2] | (header[3] << 8);
+            bool matches = header[0] == cls && header[1] == id && size <= max_size;
+
+            uint8_t ck_a = 0, ck_b = 0;
+            for (uint8_t b : header) {
+                ck_a += b;
+                ck_b += ck_a;
+            }
+
+            for (uint16_t i = 0; i < size; ++i) {
+                int c = read();
+                if (c < 0) {
+                    return false;
+                }
+
+                if (matches) {
+                    payload[i] = c;
+                }
+
+                ck_a += c;
+                ck_b += ck_a;
+            }
+
+            int frame_ck_a = read(), frame_ck_b = read();
+            if (matches && frame_ck_a == ck_a && frame_ck_b == ck_b) {
+                return true;
+            }
+        }
+    }
+
+    // Applies and saves the configuration.
+    void configure()
+    {
+        // Only output UBX frames, the MCU would otherwise receive NMEA sentences it never reads.
+        instance_.setUART1Output(COM_TYPE_UBX);
+
+        // Changing the enabled constellations restarts the receiver, which then loses its
+        // satellites data.
+        for (sfe_ublox_gnss_ids_e id : GNSS_IDS) {
+            bool enabled = constellations_ & constellation(id);
+
+            if (instance_.isGNSSenabled(id) != enabled) {
+                instance_.enableGNSS(enabled, id);
+            }
+        }
+
+        power_save(false);
+
+        // Polls the positions when required instead of having the module continuously sending
+        // them.
+        instance_.setAutoPVT(false);
+
+        // The module restarts with the saved configuration when leaving the backup mode.
+        instance_.saveConfigSelective(SAVED_CONFIG);
+
+        configured_ = true;
+    }
 };
 
-const gps_t::gnss_config_t gps_t::GNSS_CONFIG[] = {
-    {SFE_UBLOX_GNSS_ID_GPS, true},
-    {SFE_UBLOX_GNSS_ID_SBAS, false},
-    {SFE_UBLOX_GNSS_ID_GALILEO, true},
-    {SFE_UBLOX_GNSS_ID_BEIDOU, false},
-    {SFE_UBLOX_GNSS_ID_IMES, false},
-    {SFE_UBLOX_GNSS_ID_QZSS, false},
-    {SFE_UBLOX_GNSS_ID_GLONASS, true}
+const sfe_ublox_gnss_ids_e gps_t::GNSS_IDS[] = {
+    SFE_UBLOX_GNSS_ID_GPS,
+    SFE_UBLOX_GNSS_ID_SBAS,
+    SFE_UBLOX_GNSS_ID_GALILEO,
+    SFE_UBLOX_GNSS_ID_BEIDOU,
+    SFE_UBLOX_GNSS_ID_IMES,
+    SFE_UBLOX_GNSS_ID_QZSS,
+    SFE_UBLOX_GNSS_ID_GLONASS
 };
 
 }
\ No newline at end of file
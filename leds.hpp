@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstdint>
+
 #include <Arduino.h>
 
 namespace bike_tracker {
@@ -51,4 +53,125 @@ led_t led_t::blue{5};
 
 led_t *led_t::all[2] {&builtin, &blue};
 
+// How the leds report the activity of the tracker.
+enum class led_policy_t : uint8_t {
+    OFF,        // Never lit, e.g. in production.
+    EVENTS,     // Short blinks on events only.
+    DEBUG,      // Blinks on events, and the blue led is lit while awake.
+};
+
+enum class led_event_t : uint8_t { FIX, UPLINK, UPLINK_FAILED, TRACKING, POWER_SAVE, ERROR };
+
+// Records the events to report until they are blinked by `blink()`, so that the blinks are
+// scheduled with the tasks instead of delaying them.
+//
+// Each event is blinked once, however many times it happened since the last `blink()`.
+class led_activity_t {
+public:
+    explicit led_activity_t(led_policy_t policy) :
+        policy_(policy)
+    { }
+
+    led_policy_t policy() const
+    {
+        return policy_;
+    }
+
+    void policy(led_policy_t policy)
+    {
+        policy_ = policy;
+        pending_ = 0;
+    }
+
+    void notify(led_event_t event)
+    {
+        if (policy_ != led_policy_t::OFF) {
+            pending_ |= 1 << static_cast<uint8_t>(event);
+        }
+    }
+
+    // True if some events have not been blinked yet.
+    bool pending() const
+    {
+        return pending_ != 0;
+    }
+
+    // Blinks the pending events, in the order of `led_event_t`. Keeps the MCU awake for
+    // `BLINK_PERIOD` per blink.
+    void blink()
+    {
+        for (uint8_t i = 0; i < N_EVENTS; ++i) {
+            if (!(pending_ & (1 << i))) {
+                continue;
+            }
+
+            const pattern_t &pattern = PATTERNS[i];
+
+            for (uint8_t j = 0; j < pattern.n_blinks; ++j) {
+                set(pattern.leds, true);
+                delay(BLINK_DURATION);
+                set(pattern.leds, false);
+                delay(BLINK_PERIOD - BLINK_DURATION);
+            }
+        }
+
+        pending_ = 0;
+        awake();
+    }
+
+    // Lights the blue led while awake, in the DEBUG policy.
+    void awake()
+    {
+        led_t::blue.set(policy_ == led_policy_t::DEBUG);
+    }
+
+    void asleep()
+    {
+        set(ALL_LEDS, false);
+    }
+
+private:
+    static constexpr uint8_t N_EVENTS = 6;
+
+    static constexpr uint32_t BLINK_DURATION = 50; // ms
+    static constexpr uint32_t BLINK_PERIOD = 200; // ms
+
+    // Bits of `led_t::all`.
+    static constexpr uint8_t BUILTIN_LED = 0x1;
+    static constexpr uint8_t BLUE_LED = 0x2;
+    static constexpr uint8_t ALL_LEDS = BUILTIN_LED | BLUE_LED;
+
+    struct pattern_t {
+        uint8_t leds;
+        uint8_t n_blinks;
+    };
+
+    // Indexed by `led_event_t`.
+    static constexpr pattern_t PATTERNS[N_EVENTS] = {
+        { BLUE_LED, 1 },        // FIX
+        { BUILTIN_LED, 1 },     // UPLINK
+        { BUILTIN_LED, 3 },     // UPLINK_FAILED
+        { BLUE_LED, 2 },        // TRACKING
+        { BLUE_LED, 3 },        // POWER_SAVE
+        { ALL_LEDS, 3 },        // ERROR
+    };
+
+    led_policy_t policy_;
+
+    // Bits of the events to blink.
+    uint8_t pending_{0};
+
+    static void set(uint8_t leds, bool on)
+    {
+        for (size_t i = 0; i < 2; ++i) {
+            if (leds & (1 << i)) {
+                led_t::all[i]->set(on);
+            }
+        }
+    }
+};
+
+// Set by `bike_tracker_t::setup()` from its profile.
+led_activity_t led_activity{led_policy_t::OFF};
+
 }
\ No newline at end of file
@@ -2,37 +2,166 @@
 
 #include <Arduino.h>
 
+#include "benchmark.hpp"
 #include "leds.hpp"
 
+// Writes messages to the serial port.
+//
+// A message is a list of values (strings, numbers, or the `fixed()`, `hex()` and `bytes()`
+// formats) formatted with `Print` into a static line buffer, so that logging never allocates.
+// Messages below `LEVEL` are compiled away, but their arguments are still evaluated: the call sites
+// computing them (e.g. querying a peripheral) are guarded by `if constexpr (LEVEL >= ...)`.
 namespace bike_tracker::logger {
 
-void error(const String &msg)
+enum class level_t : uint8_t { NONE, ERROR, WARNING, INFO };
+
+// Debug builds (with `BIKE_TRACKER_DEBUG` defined, see `bike_tracker_t::DEBUG`) and host builds
+// log every message. Otherwise nothing is listening on the serial port, and only the errors are
+// logged.
+#if defined(BIKE_TRACKER_DEBUG) || !defined(ARDUINO)
+constexpr level_t LEVEL = level_t::INFO;
+#else
+constexpr level_t LEVEL = level_t::ERROR;
+#endif
+
+// Longer messages are truncated.
+constexpr size_t LINE_SIZE = 128;
+
+// A number printed with `digits` decimals.
+struct fixed_t {
+    double value;
+    uint8_t digits;
+};
+
+fixed_t fixed(double value, uint8_t digits)
+{
+    return fixed_t{value, digits};
+}
+
+// An unsigned integer printed in hexadecimal, without leading zeros.
+struct hex_t {
+    unsigned long value;
+};
+
+hex_t hex(unsigned long value)
+{
+    return hex_t{value};
+}
+
+// A byte array printed in hexadecimal, two digits per byte, separated by spaces.
+struct bytes_t {
+    const uint8_t *data;
+    size_t size;
+};
+
+bytes_t bytes(const uint8_t *data, size_t size)
 {
-    Serial.print("[ERROR]   ");
-    Serial.println(msg);
+    return bytes_t{data, size};
+}
 
-    // Blinks all the leds and never return.
-    bool leds_on = true;
-    for (;;) {
-        for (led_t *led : led_t::all) {
-            led->set(leds_on);
+class line_t : public Print {
+public:
+    size_t write(uint8_t c) override
+    {
+        if (size_ < LINE_SIZE) {
+            data_[size_++] = c;
+            return 1;
+        } else {
+            return 0;
         }
+    }
+
+    using Print::write;
+
+    void clear()
+    {
+        size_ = 0;
+    }
+
+    const uint8_t *data() const
+    {
+        return data_;
+    }
 
-        delay(500);
-        leds_on = !leds_on;
+    size_t size() const
+    {
+        return size_;
     }
+
+private:
+    uint8_t data_[LINE_SIZE];
+    size_t size_{0};
+};
+
+line_t line_;
+
+template<typename T>
+void print(const T &value)
+{
+    line_.print(value);
 }
 
-void warning(const String &msg)
+void print(const fixed_t &value)
 {
-    Serial.print("[WARNING] ");
-    Serial.println(msg);
+    line_.print(value.value, value.digits);
 }
 
-void info(const String &msg)
+void print(const hex_t &value)
 {
-    Serial.print("[INFO]    ");
-    Serial.println(msg);
+    line_.print(value.value, HEX);
 }
 
-}
\ No newline at end of file
+void print(const bytes_t &value)
+{
+    for (size_t i = 0; i < value.size; ++i) {
+        if (value.data[i] < 0x10) {
+            line_.print('0');
+        }
+        line_.print(value.data[i], HEX);
+        line_.print(' ');
+    }
+}
+
+template<typename... args_t>
+void write(const char *prefix, const args_t &...args)
+{
+    benchmark::scope_t scope(benchmark::stage_t::LOG);
+
+    line_.clear();
+    line_.print(prefix);
+    (print(args), ...);
+
+    Serial.write(line_.data(), line_.size());
+    Serial.println();
+}
+
+// Reports an unrecoverable failure of a peripheral, also blinked by the leds, depending on their
+// policy (see `led_activity_t`). The caller gives up the current task, which is then retried after
+// the next sleep.
+template<typename... args_t>
+void error(const args_t &...args)
+{
+    if constexpr (LEVEL >= level_t::ERROR) {
+        write("[ERROR]   ", args...);
+    }
+
+    led_activity.notify(led_event_t::ERROR);
+}
+
+template<typename... args_t>
+void warning(const args_t &...args)
+{
+    if constexpr (LEVEL >= level_t::WARNING) {
+        write("[WARNING] ", args...);
+    }
+}
+
+template<typename... args_t>
+void info(const args_t &...args)
+{
+    if constexpr (LEVEL >= level_t::INFO) {
+        write("[INFO]    ", args...);
+    }
+}
+
+}
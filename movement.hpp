@@ -4,27 +4,72 @@
 
 #include <Arduino.h>
 #include <ArduinoLowPower.h>
+#include <Wire.h>
 
 #include "logger.hpp"
 
 namespace bike_tracker {
 
+// Detects movements using a LIS3DH accelerometer, on I2C, with its INT1 output connected on pin
+// `pin_num`.
+//
+// The accelerometer latches an interrupt when the acceleration (without gravity) exceeds
+// `MOTION_THRESHOLD` for `MOTION_DURATION` on any axis. Shorter or lighter vibrations (e.g. traffic
+// on a busy street) are ignored.
+//
+// Falls back to a vibration switch pulling `pin_num` LOW if no accelerometer answers.
 class movement_detector_t {
 
 public:
-    movement_detector_t(pin_size_t pin_num) : pin_num_(pin_num)
+    movement_detector_t(pin_size_t pin_num, uint8_t address = 0x18) :
+        pin_num_(pin_num), address_(address)
     { }
 
     void setup()
     {
         pinMode(pin_num_, INPUT);
+
+        Wire.begin();
+
+        has_accelerometer_ = read_register(WHO_AM_I) == WHO_AM_I_VALUE;
+
+        if (!has_accelerometer_) {
+            logger::warning("No accelerometer, using the vibration switch.");
+            return;
+        }
+
+        // 10 Hz, low power mode, XYZ enabled.
+        write_register(CTRL_REG1, 0x2f);
+
+        // High-pass filter on the INT1 generator, which removes the gravity.
+        write_register(CTRL_REG2, 0x01);
+
+        // INT1 generator on the INT1 pin, latched until INT1_SRC is read.
+        write_register(CTRL_REG3, 0x40);
+        write_register(CTRL_REG4, 0x00); // ±2 g
+        write_register(CTRL_REG5, 0x08);
+
+        write_register(INT1_THS, MOTION_THRESHOLD / 16);         // 16 mg units at ±2 g
+        write_register(INT1_DURATION, MOTION_DURATION / 100);    // 1/ODR units
+
+        // Interrupt on high events, on any axis.
+        write_register(INT1_CFG, 0x2a);
+
+        read_register(INT1_SRC);
+
+        logger::info("Accelerometer initialized.");
     }
 
-    /** Enables a asynchronous movement detection. */
+    /** Enables a asynchronous movement detection, which wakes the MCU up. */
     void enable()
     {
         logger::info("Enable asynchronous movement detection");
-        attachInterrupt(digitalPinToInterrupt(pin_num_), on_interrupt, LOW);
+
+        if (has_accelerometer_) {
+            LowPower.attachInterruptWakeup(digitalPinToInterrupt(pin_num_), on_interrupt, RISING);
+        } else {
+            attachInterrupt(digitalPinToInterrupt(pin_num_), on_interrupt, LOW);
+        }
     }
 
     /** Disables asynchronous movement detector connected on pin `pin_num`. */
@@ -34,29 +79,107 @@ public:
         detachInterrupt(digitalPinToInterrupt(pin_num_));
     }
 
-    /** Returns true if some movement has been detected since the last call to `reset()`. */
-    static bool detected()
+    /**
+     * Returns true if some movement has been detected since the last call to `reset()`.
+     *
+     * Also polls the accelerometer, so that movements are detected when the asynchronous
+     * detection is disabled.
+     */
+    bool detected()
     {
+        if (has_accelerometer_ && (read_register(INT1_SRC) & INT1_SRC_IA)) {
+            detected_ = true;
+        }
+
         return detected_;
     }
 
-    static void reset()
+    void reset(uint32_t now)
     {
-        logger::info("Reset asynchronous movement detection (was: " + String(detected()) + ")");
+        // Also clears the interrupt latched by the accelerometer, whatever the log level.
+        bool was_detected = detected();
+
+        logger::info("Reset asynchronous movement detection (was: ", was_detected, ")");
         detected_ = false;
+        last_movement_time_ = now;
+    }
+
+    /**
+     * Returns the number of seconds without any movement, up to `now`, since the last detected
+     * movement or call to `reset()`. Should be called regularly, as movements are only timed when
+     * polled.
+     *
+     * Always returns 0 without an accelerometer, as the vibration switch does not latch.
+     */
+    uint32_t still_for(uint32_t now)
+    {
+        if (!has_accelerometer_) {
+            return 0;
+        }
+
+        if (detected()) {
+            detected_ = false;
+            last_movement_time_ = now;
+        }
+
+        return now - last_movement_time_;
     }
 
 private:
+    // Acceleration peaks triggering a movement detection.
+    static constexpr uint32_t MOTION_THRESHOLD = 128;   // mg
+    static constexpr uint32_t MOTION_DURATION = 200;    // ms
+
+    // LIS3DH registers.
+    static constexpr uint8_t WHO_AM_I = 0x0f;
+    static constexpr uint8_t CTRL_REG1 = 0x20;
+    static constexpr uint8_t CTRL_REG2 = 0x21;
+    static constexpr uint8_t CTRL_REG3 = 0x22;
+    static constexpr uint8_t CTRL_REG4 = 0x23;
+    static constexpr uint8_t CTRL_REG5 = 0x24;
+    static constexpr uint8_t INT1_CFG = 0x30;
+    static constexpr uint8_t INT1_SRC = 0x31;
+    static constexpr uint8_t INT1_THS = 0x32;
+    static constexpr uint8_t INT1_DURATION = 0x33;
+
+    static constexpr uint8_t WHO_AM_I_VALUE = 0x33;
+    static constexpr uint8_t INT1_SRC_IA = 0x40;
+
     static volatile bool detected_;
 
     pin_size_t pin_num_;
+    uint8_t address_;
+
+    bool has_accelerometer_{false};
+
+    uint32_t last_movement_time_{0};
 
     static void on_interrupt()
     {
         detected_ = true;
     }
+
+    void write_register(uint8_t reg, uint8_t value)
+    {
+        Wire.beginTransmission(address_);
+        Wire.write(reg);
+        Wire.write(value);
+        Wire.endTransmission();
+    }
+
+    // Returns 0 if the accelerometer does not answer.
+    uint8_t read_register(uint8_t reg)
+    {
+        Wire.beginTransmission(address_);
+        Wire.write(reg);
+        if (Wire.endTransmission(false) != 0 || Wire.requestFrom(address_, (uint8_t) 1) != 1) {
+            return 0;
+        }
+
+        return Wire.read();
+    }
 };
 
 volatile bool movement_detector_t::detected_{false};
 
-}
\ No newline at end of file
+}
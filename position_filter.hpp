@@ -0,0 +1,213 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+#include <Arduino.h>
+#include <etl/optional.h>
+
+#include "gps.hpp"
+#include "logger.hpp"
+
+namespace bike_tracker {
+
+// Smooths the successive GPS positions with a constant velocity Kalman filter, weighting each fix
+// with the accuracy the receiver estimated for it.
+//
+// Each axis (east, north and up, in meters from the latest filtered position) is filtered
+// independently. The bike is expected to accelerate by about `acceleration` m/s², and fixes
+// further than `gate` standard deviations from the prediction are rejected as outliers.
+class position_filter_t {
+public:
+    position_filter_t(float acceleration, float gate) :
+        acceleration_(acceleration), gate_(gate)
+    { }
+
+    // Filters the position probed at `time` (in secs), with an horizontal accuracy of `h_acc`
+    // meters. Returns false if the position has been rejected as an outlier.
+    bool update(uint32_t time, const gps_t::coordinates_t &coordinates, float h_acc)
+    {
+        float h_var = max(h_acc * h_acc, MIN_VARIANCE);
+        float v_var = h_var * VERTICAL_VARIANCE_RATIO;
+
+        if (!origin_.has_value() || time - time_ > MAX_DELAY || n_rejected_ >= MAX_REJECTED) {
+            reset(time, coordinates, h_var, v_var);
+            return true;
+        }
+
+        float dt = time - time_;
+        float q = acceleration_ * acceleration_;
+
+        // Predicts into copies, so that a rejected fix leaves the state at the previous update.
+        axis_t east_axis = east_, north_axis = north_, up_axis = up_;
+        east_axis.predict(dt, q);
+        north_axis.predict(dt, q);
+        up_axis.predict(dt, q);
+
+        float east, north;
+        to_local(coordinates, &east, &north);
+        float up = coordinates.alt_meters();
+
+        // Gates on the horizontal innovation only, the altitude being much noisier.
+        float distance_sq =
+            east_axis.normalized_innovation(east, h_var) +
+            north_axis.normalized_innovation(north, h_var);
+
+        if (distance_sq > gate_ * gate_) {
+            if constexpr (logger::LEVEL >= logger::level_t::WARNING) {
+                logger::warning(
+                    "GPS probe rejected as an outlier (", logger::fixed(sqrtf(distance_sq), 1),
+                    " std. deviations)");
+            }
+            ++n_rejected_;
+            return false;
+        }
+
+        east_axis.correct(east, h_var);
+        north_axis.correct(north, h_var);
+        up_axis.correct(up, v_var);
+
+        east_ = east_axis;
+        north_ = north_axis;
+        up_ = up_axis;
+
+        recenter();
+
+        time_ = time;
+        n_rejected_ = 0;
+
+        return true;
+    }
+
+    // The filtered coordinates. Undefined before the first update.
+    gps_t::coordinates_t coordinates() const
+    {
+        return gps_t::coordinates_t{
+            origin_->lat + (int32_t) lroundf(north_.position / UNIT_LENGTH),
+            origin_->lng + (int32_t) lroundf(east_.position / (UNIT_LENGTH * cos_lat_)),
+            (int32_t) lroundf(up_.position * 1000.0f),
+        };
+    }
+
+private:
+    // Length of 1e-7 degree of latitude.
+    static constexpr float UNIT_LENGTH = 6371.0f * 1000.0f * (float) M_PI / 180.0f * 1e-7f; // m
+
+    // Restarts the filter from the next fix after 10 minutes without any fix (e.g. when parked), or
+    // after 3 successive outliers (e.g. the bike moved in a car, or the filter diverged).
+    static constexpr uint32_t MAX_DELAY = 10 * 60; // sec
+    static constexpr uint8_t MAX_REJECTED = 3;
+
+    // The receiver can report unrealistically low accuracies.
+    static constexpr float MIN_VARIANCE = 1.0f; // m²
+
+    // The vertical accuracy is about twice worse than the horizontal one.
+    static constexpr float VERTICAL_VARIANCE_RATIO = 4.0f;
+
+    // Position and velocity along an axis, and their covariance.
+    struct axis_t {
+        float position;     // m
+        float velocity;     // m/s
+
+        float p_pos;        // m²
+        float p_pos_vel;    // m²/s
+        float p_vel;        // m²/s²
+
+        void reset(float position_, float variance)
+        {
+            position = position_;
+            velocity = 0.0f;
+
+            p_pos = variance;
+            p_pos_vel = 0.0f;
+
+            // The bike might be moving at up to about 10 m/s.
+            p_vel = 100.0f;
+        }
+
+        // Predicts the state after `dt` secs, with a white noise acceleration of intensity `q`.
+        void predict(float dt, float q)
+        {
+            position += velocity * dt;
+
+            float dt2 = dt * dt;
+
+            p_pos += 2 * dt * p_pos_vel + dt2 * p_vel + q * dt2 * dt / 3;
+            p_pos_vel += dt * p_vel + q * dt2 / 2;
+            p_vel += q * dt;
+        }
+
+        // Returns the squared innovation of the measurement, normalized by its variance.
+        float normalized_innovation(float measurement, float variance) const
+        {
+            float innovation = measurement - position;
+            return innovation * innovation / (p_pos + variance);
+        }
+
+        void correct(float measurement, float variance)
+        {
+            float innovation = measurement - position;
+            float s = p_pos + variance;
+
+            float k_pos = p_pos / s;
+            float k_vel = p_pos_vel / s;
+
+            position += k_pos * innovation;
+            velocity += k_vel * innovation;
+
+            p_vel -= k_vel * p_pos_vel;
+            p_pos_vel -= k_vel * p_pos;
+            p_pos -= k_pos * p_pos;
+        }
+    };
+
+    float acceleration_;
+    float gate_;
+
+    // The origin of the east and north axes, moved to the filtered position after every update so
+    // that the projection stays accurate. Undefined until the first update.
+    etl::optional<gps_t::coordinates_t> origin_;
+    float cos_lat_{1.0f};
+
+    uint32_t time_{0};
+    uint8_t n_rejected_{0};
+
+    axis_t east_{}, north_{}, up_{};
+
+    void reset(uint32_t time, const gps_t::coordinates_t &coordinates, float h_var, float v_var)
+    {
+        origin_ = coordinates;
+        cos_lat_ = cosf(coordinates.lat_degrees() * (float) M_PI / 180.0f);
+
+        east_.reset(0.0f, h_var);
+        north_.reset(0.0f, h_var);
+        up_.reset(coordinates.alt_meters(), v_var);
+
+        time_ = time;
+        n_rejected_ = 0;
+    }
+
+    // Moves the origin to the filtered position, keeping the sub-unit remainder.
+    void recenter()
+    {
+        gps_t::coordinates_t filtered = coordinates();
+        filtered.alt = origin_->alt;
+
+        float east_offset, north_offset;
+        to_local(filtered, &east_offset, &north_offset);
+
+        north_.position -= north_offset;
+        east_.position -= east_offset;
+
+        origin_ = filtered;
+        cos_lat_ = cosf(filtered.lat_degrees() * (float) M_PI / 180.0f);
+    }
+
+    void to_local(const gps_t::coordinates_t &coordinates, float *east, float *north) const
+    {
+        *east = (float) (coordinates.lng - origin_->lng) * UNIT_LENGTH * cos_lat_;
+        *north = (float) (coordinates.lat - origin_->lat) * UNIT_LENGTH;
+    }
+};
+
+}
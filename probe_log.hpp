@@ -0,0 +1,194 @@
+#pragma once
+
+#include <cstdint>
+
+#include <Arduino.h>
+#include <FlashStorage.h>
+#include <etl/deque.h>
+#include <etl/optional.h>
+
+#include "gps.hpp"
+#include "logger.hpp"
+
+namespace bike_tracker {
+
+// Keeps the successful GPS probes that have not been transmitted yet, the oldest first.
+//
+// When full, pushing a new probe overwrites the oldest one.
+class probe_log_t {
+public:
+    // Holds 32 minutes of probes in TRACKING mode.
+    static constexpr size_t CAPACITY = 96;
+
+    struct probe_t {
+        uint32_t time; // RTC epoch, in secs
+        gps_t::coordinates_t coordinates;
+    };
+
+    void push(uint32_t time, const gps_t::coordinates_t &coordinates)
+    {
+        if (probes_.full()) {
+            probes_.pop_front();
+            ++n_dropped_;
+        }
+
+        probes_.push_back(probe_t{time, coordinates});
+    }
+
+    size_t size() const
+    {
+        return probes_.size();
+    }
+
+    bool empty() const
+    {
+        return probes_.empty();
+    }
+
+    const probe_t &operator[](size_t i) const
+    {
+        return probes_[i];
+    }
+
+    // Returns the number of probes that have been probed up to (including) `time`.
+    size_t count_until(uint32_t time) const
+    {
+        size_t n = 0;
+        while (n < probes_.size() && probes_[n].time <= time) {
+            ++n;
+        }
+        return n;
+    }
+
+    // Removes the `n` oldest probes.
+    void pop_front(size_t n)
+    {
+        for (; n > 0 && !probes_.empty(); --n) {
+            probes_.pop_front();
+        }
+    }
+
+    // Removes every probe probed after `time`.
+    void pop_after(uint32_t time)
+    {
+        while (!probes_.empty() && probes_.back().time > time) {
+            probes_.pop_back();
+        }
+    }
+
+    void clear()
+    {
+        probes_.clear();
+        rebased_until_ = etl::nullopt;
+    }
+
+    // Number of probes lost since the log has been created because it was full.
+    uint32_t n_dropped() const
+    {
+        return n_dropped_;
+    }
+
+    // Layout of the log in flash.
+    struct snapshot_t {
+        // Only restores snapshots written with the same layout.
+        static constexpr uint32_t MAGIC = 0xb1ce0003;
+
+        uint32_t magic;
+        uint32_t size;
+        bool has_clock_offset;
+        uint32_t clock_offset;
+        probe_t probes[CAPACITY];
+    };
+
+    // Writes the log to a SAMD21 flash row, with `clock_offset`, the GPS time minus the RTC epoch
+    // of the probes, if known.
+    //
+    // Every write erases a flash row, which only supports about 10,000 erase cycles. Should only be
+    // called on rare events.
+    void save(FlashStorageClass<snapshot_t> &storage, etl::optional<uint32_t> clock_offset) const;
+
+    // Restores the log written by `save()` to `storage`, if any.
+    //
+    // If `rebase`, as the RTC epoch restarted at 0, the probes are restored relative to the oldest
+    // one, which gets a time of 0 (see `rebased()`). Otherwise, they keep their time. Returns the
+    // time following the most recent restored probe, or 0 if no probe has been restored.
+    uint32_t restore(FlashStorageClass<snapshot_t> &storage, bool rebase = true);
+
+    // True if the probe at `i` has been restored by a rebasing `restore()`: its time is then only
+    // relative to the other restored probes, and its GPS time is its time plus `rebased_offset()`.
+    bool rebased(size_t i) const
+    {
+        return rebased_until_.has_value() && probes_[i].time <= *rebased_until_;
+    }
+
+    // The GPS time minus the time of the rebased probes, if the offset of the RTC was known when
+    // they have been saved.
+    etl::optional<uint32_t> rebased_offset() const
+    {
+        return rebased_offset_;
+    }
+
+private:
+    etl::deque<probe_t, CAPACITY> probes_{};
+
+    uint32_t n_dropped_{0};
+
+    // The time of the most recent rebased probe, if any.
+    etl::optional<uint32_t> rebased_until_;
+    etl::optional<uint32_t> rebased_offset_;
+};
+
+void probe_log_t::save(
+    FlashStorageClass<snapshot_t> &storage, etl::optional<uint32_t> clock_offset) const
+{
+    logger::info("Saving ", probes_.size(), " probe(s) to flash");
+
+    snapshot_t snapshot{};
+
+    snapshot.magic = snapshot_t::MAGIC;
+    snapshot.size = probes_.size();
+    snapshot.has_clock_offset = clock_offset.has_value();
+    snapshot.clock_offset = clock_offset.value_or(0);
+    for (size_t i = 0; i < probes_.size(); ++i) {
+        snapshot.probes[i] = probes_[i];
+    }
+
+    storage.write(snapshot);
+}
+
+uint32_t probe_log_t::restore(FlashStorageClass<snapshot_t> &storage, bool rebase)
+{
+    snapshot_t snapshot;
+    storage.read(&snapshot);
+
+    if (snapshot.magic != snapshot_t::MAGIC || snapshot.size == 0 || snapshot.size > CAPACITY) {
+        return 0;
+    }
+
+    logger::info("Restoring ", snapshot.size, " probe(s) from flash");
+
+    probes_.clear();
+
+    uint32_t first_time = rebase ? snapshot.probes[0].time : 0;
+    for (size_t i = 0; i < snapshot.size; ++i) {
+        probe_t probe = snapshot.probes[i];
+        probe.time -= first_time;
+        probes_.push_back(probe);
+    }
+
+    if (rebase) {
+        rebased_until_ = probes_.back().time;
+        rebased_offset_ = etl::nullopt;
+        if (snapshot.has_clock_offset) {
+            rebased_offset_ = snapshot.clock_offset + first_time;
+        }
+    }
+
+    // Erases the snapshot, so that the same probes are not restored twice.
+    snapshot.magic = 0;
+    storage.write(snapshot);
+
+    return probes_.back().time + 1;
+}
+
+}
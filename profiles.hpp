@@ -0,0 +1,183 @@
+#pragma once
+
+#include <cstdint>
+
+#include "gps.hpp"
+#include "leds.hpp"
+#include "radio.hpp"
+
+// Tuning of `bike_tracker_t`, each profile building a firmware for a kind of use.
+//
+// Profiles derive from `commuter_profile_t` and only redefine the constants they change.
+namespace bike_tracker {
+
+// Daily rides in town, with good SigFox coverage.
+struct commuter_profile_t {
+    // Will consider the bike idle if it moves slower than 4kph between two GPS probes.
+    static constexpr float IDLE_THRESHOLD = 4.0f * 1000.0f / 3600.0f; // meters per sec
+
+    // Will wait 5 seconds after an unsuccessful GPS probe before trying again, up to 10 times.
+    // When the maximum number of retries is reached, considers the next unsuccessful probes as
+    // IDLE.
+    static constexpr uint32_t GPS_RETRY_DELAY = 5; // sec
+    static constexpr uint32_t GPS_MAX_RETRIES = 10;
+
+    // The GPS module leaves its backup mode by itself 5 seconds before the next probe, about the
+    // time of a hot start.
+    static constexpr uint32_t GPS_WAKE_UP_LEAD = 5; // sec
+
+    // Will wait 1 minute after an unsuccessful radio message before trying again.
+    static constexpr uint32_t RADIO_RETRY_DELAY = 60; // sec
+
+    // The probes that could not be transmitted (e.g. when out of SigFox coverage) are sent once the
+    // radio works again, every 30 seconds, in `radio_t::backlog_msg_t` messages each summarizing up
+    // to 12 probes.
+    static constexpr uint32_t RADIO_BACKLOG_DELAY = 30; // sec
+    static constexpr uint32_t RADIO_BACKLOG_MSG_PROBES = 12;
+
+    // SigFox allows 140 uplinks and 4 downlinks a day. No message is sent once the uplinks quota is
+    // reached, until the end of the quota window.
+    static constexpr uint32_t RADIO_DAILY_UPLINKS = 140;
+    static constexpr uint32_t RADIO_DAILY_DOWNLINKS = 4;
+
+    // Messages are plain uplinks, except for a downlink request (to receive `radio_t::config_cmd_t`
+    // commands) on the first message, and then every 6 hours or 30 messages, whichever comes
+    // first, within the downlinks quota.
+    static constexpr uint32_t RADIO_DOWNLINK_DELAY = 6 * 60 * 60; // sec
+    static constexpr uint32_t RADIO_DOWNLINK_MSGS = 30;
+
+    // Saves the probes that could not be transmitted to flash when entering POWER_SAVE, and
+    // restores them on setup.
+    static constexpr bool PROBE_LOG_PERSISTENT = false;
+
+    // Filters the GPS probes with a Kalman filter (see `position_filter_t`), expecting
+    // accelerations of about 1 m/s², and rejecting the probes more than 4 standard deviations away
+    // from the predicted position as outliers.
+    static constexpr float GPS_FILTER_ACCELERATION = 1.0f;  // m/s²
+    static constexpr float GPS_FILTER_GATE = 4.0f;          // std. deviations
+
+    // When in the TRACKING state, probes the location and speed every 20 seconds, and sends the
+    // location every 3 minutes, except for the first radio message being transmitted after 1 minute
+    // (about the time to get a GPS fix).
+    static constexpr uint32_t TRACKING_GPS_PROBE_DELAY      = 20;        // sec
+    static constexpr uint32_t TRACKING_RADIO_DELAY          = 3 * 60;    // sec
+    static constexpr uint32_t TRACKING_RADIO_FIRST_DELAY    = 60;        // sec
+
+    // When moving, the delay between GPS probes adapts so that successive probes are about 250
+    // meters apart on straight lines, within [10..60] seconds. Probes every 10 seconds when the
+    // heading changed by 45° or more since the previous probe, and never waits more than the
+    // default 20 seconds when the fix uses less than 6 satellites.
+    //
+    // IDLE and UNKNOWN probes always use the default delay, so that the idle probes window still
+    // spans 4 minutes when the bike stops.
+    static constexpr uint32_t TRACKING_GPS_PROBE_MIN_DELAY  = 10;        // sec
+    static constexpr uint32_t TRACKING_GPS_PROBE_MAX_DELAY  = 60;        // sec
+    static constexpr float TRACKING_GPS_PROBE_DISTANCE      = 250.0f;    // meters
+    static constexpr float TRACKING_GPS_TURN_ANGLE          = 45.0f;     // degrees
+    static constexpr uint8_t TRACKING_GPS_MIN_SATELLITES    = 6;
+
+    // Powers the GPS off between TRACKING probes at least 80 seconds apart (i.e. when the battery
+    // is low), as a hot start only takes a few seconds.
+    static constexpr uint32_t TRACKING_GPS_SLEEP_DELAY      = 80;        // sec
+
+    // If enabled, and supported by the GPS module (see `gps_t::start_batching()`), the module
+    // computes the TRACKING fixes by itself, every default probe delay, and the controller only
+    // wakes up to read them before sending the location message. The adaptive probe delays do not
+    // apply then, and the idle probes are only checked at every location message.
+    static constexpr bool TRACKING_GPS_BATCHING = false;
+
+    // The tracker will move into the POWER_SAVE state if there the sensor stayed idle for 9 of the
+    // last 12 location probes (4 minutes).
+    static constexpr uint32_t TRACKING_IDLE_PROBES      = 9;
+    static constexpr uint32_t TRACKING_IDLE_BUFFER_SIZE = 12;
+
+    // Also moves into the POWER_SAVE state if the accelerometer did not detect any movement for 2
+    // minutes, and the latest location probe was idle.
+    static constexpr uint32_t TRACKING_STILL_DELAY = 2 * 60; // sec
+
+    // When in POWER_SAVE mode, probes and transmit the location every 60 minutes.
+    static constexpr uint32_t POWER_SAVE_GPS_PROBE_DELAY = 60 * 60;  // sec
+
+    // Only sends a message without location instead when the probed location is within 100 meters
+    // of the last location sent: an idle probe can still be kilometers away after such a delay.
+    static constexpr float POWER_SAVE_HEARTBEAT_RADIUS = 100.0f; // meters
+
+    // Up to 4 parking zones (e.g. home and work) can be set by downlink (see
+    // `radio_t::zone_cmd_t`). When entering POWER_SAVE in one of them, with a GPS fix of less than
+    // 10 minutes, the GPS probes are suspended until the movement detector triggers, and a message
+    // without location is sent every 12 hours instead.
+    static constexpr size_t POWER_SAVE_ZONES = 4;
+    static constexpr uint32_t POWER_SAVE_ZONE_MAX_FIX_AGE = 10 * 60;            // sec
+    static constexpr uint32_t POWER_SAVE_ZONE_HEARTBEAT_DELAY = 12 * 60 * 60;   // sec
+
+    // Doubles the TRACKING probe and radio delays and the POWER_SAVE probe delay as the battery
+    // drops below each of these levels (i.e. 4 times longer delays below 15%). A step is only left
+    // once the battery is 5% above its level again, so that the delays do not flap with the
+    // voltage (e.g. when the cold makes it drop).
+    static constexpr uint8_t BATTERY_STEP_LEVELS[] = { 30, 15, 5 };   // %
+    static constexpr uint8_t BATTERY_STEP_HYSTERESIS = 5;             // %
+
+    // Sends the battery voltage and the estimated charge consumed by each subsystem every 24
+    // hours.
+    static constexpr bool TELEMETRY_ENABLED = false;
+    static constexpr uint32_t TELEMETRY_DELAY = 24 * 60 * 60; // sec
+
+    // Message used to transmit locations. Either `radio_t::location_msg_t` (the latest location and
+    // the distance, altitude gain and moving time since the previous message), or
+    // `radio_t::track_msg_t` (up to 6 of the locations probed since the previous message).
+    using location_msg_t = radio_t::location_msg_t;
+
+    // The leds stay off, as each draws a few mA while lit (see `led_activity_t`). Pressing the
+    // button blinks the events for 10 minutes.
+    static constexpr led_policy_t LED_POLICY = led_policy_t::OFF;
+    static constexpr uint32_t LED_DIAGNOSTIC_DELAY = 10 * 60; // sec
+
+    // Uses GPS, Galileo and GLONASS.
+    static constexpr uint8_t GNSS_CONSTELLATIONS =
+        gps_t::constellation(SFE_UBLOX_GNSS_ID_GPS) |
+        gps_t::constellation(SFE_UBLOX_GNSS_ID_GALILEO) |
+        gps_t::constellation(SFE_UBLOX_GNSS_ID_GLONASS);
+};
+
+// Multiple hours rides, possibly out of SigFox coverage.
+struct long_tour_profile_t : commuter_profile_t {
+    // Sends the track every 6 minutes, as up to 6 of the locations probed since the previous
+    // message.
+    static constexpr uint32_t TRACKING_RADIO_DELAY = 6 * 60; // sec
+    using location_msg_t = radio_t::track_msg_t;
+
+    // Reads the probes of the track in a single wake-up, just before sending it.
+    static constexpr bool TRACKING_GPS_BATCHING = true;
+
+    // Does not go to POWER_SAVE on short stops: requires 18 idle probes out of the last 24 (8
+    // minutes).
+    static constexpr uint32_t TRACKING_IDLE_PROBES      = 18;
+    static constexpr uint32_t TRACKING_IDLE_BUFFER_SIZE = 24;
+    static constexpr uint32_t TRACKING_STILL_DELAY = 5 * 60; // sec
+
+    // Keeps the probes that could not be transmitted when the battery is replaced.
+    static constexpr bool PROBE_LOG_PERSISTENT = true;
+
+    static constexpr bool TELEMETRY_ENABLED = true;
+};
+
+// Mostly parked bike, that should be located quickly once moved.
+struct anti_theft_profile_t : commuter_profile_t {
+    // Sends the first location as soon as the GPS could get a fix, and then every 10 minutes
+    // (about the SigFox daily limit if the bike moves all day long).
+    static constexpr uint32_t TRACKING_RADIO_DELAY          = 10 * 60;   // sec
+    static constexpr uint32_t TRACKING_RADIO_FIRST_DELAY    = 30;        // sec
+
+    // Probes every 3 hours when parked, within the validity of the GPS ephemeris (~4 hours) for
+    // hot starts.
+    static constexpr uint32_t POWER_SAVE_GPS_PROBE_DELAY = 3 * 60 * 60;  // sec
+
+    static constexpr bool TELEMETRY_ENABLED = true;
+
+    // Uses GPS and GLONASS only, as tracking less constellations draws less current.
+    static constexpr uint8_t GNSS_CONSTELLATIONS =
+        gps_t::constellation(SFE_UBLOX_GNSS_ID_GPS) |
+        gps_t::constellation(SFE_UBLOX_GNSS_ID_GLONASS);
+};
+
+}
@@ -2,11 +2,14 @@
 
 #include <cmath>
 #include <cstdint>
+#include <cstring>
 
 #include <Arduino.h>
 #include <SigFox.h>
 #include <etl/optional.h>
 
+#include "energy.hpp"
+#include "gps.hpp"
 #include "logger.hpp"
 
 namespace bike_tracker {
@@ -14,76 +17,562 @@ namespace bike_tracker {
 class radio_t {
 public:
 
+    // The latest location, and the distance, elevation gain and moving time accumulated since the
+    // previous message.
+    //
+    // Bit layout, most significant bit first:
+    //
+    //   version       3 bits     `LOCATION_VERSION`.
+    //   lat          24 bits     In 180/2^24 degrees units (~1.2 m), offset by +90°.
+    //   lng          24 bits     In 360/2^24 degrees units (~1.5 m at 50°), offset by +180°.
+    //   alt          11 bits     In meters divided by 4, offset by +1000 m (range: [-1000..7188]
+    //                            m), saturated.
+    //   dist         11 bits     In meters, 3 bits exponent and 8 bits mantissa (range:
+    //                            [0..32640] m).
+    //   alt_gain      9 bits     Positive elevation gain, in meters, 3 bits exponent and 6 bits
+    //                            mantissa (range: [0..8064] m).
+    //   moving_time  11 bits     In seconds, 3 bits exponent and 8 bits mantissa (range: [0..9]
+    //                            hours).
+    //   saturated     3 bits     Set if `dist`, `alt_gain` or `moving_time` (in this order)
+    //                            exceeded its range, and has been saturated.
+    //
+    // The variable scale fields encode `mantissa << exponent`, with the smallest exponent the
+    // value fits in: values are exact up to the largest mantissa, and within half a unit of the
+    // exponent above (e.g. ±0.4% for 8 bits mantissas).
+    //
+    // A message with all the coordinates bits at 0 does not contain any valid location.
     struct location_msg_t {
-        static_assert(sizeof(float) == 4);
+        static constexpr uint8_t LOCATION_VERSION = 1;
+
+        uint8_t data[12];
+
+        // Constructs the message with the actual, non scaled, values.
+        location_msg_t(
+            const etl::optional<gps_t::coordinates_t> &coordinates,
+            float dist, float alt_gain, uint32_t moving_time) :
+            data{}
+        {
+            size_t offset = 0;
+            write_bits(&offset, LOCATION_VERSION, 3);
+
+            if (coordinates.has_value()) {
+                write_bits(&offset, quantize(coordinates->lat, 90 * DEGREE, 180 * DEGREE), 24);
+                write_bits(&offset, quantize(coordinates->lng, 180 * DEGREE, 360 * DEGREE), 24);
+                write_bits(
+                    &offset, constrain(lroundf(coordinates->alt_meters() / 4) + 250, 0L, 2047L),
+                    11);
+            } else {
+                offset += 24 + 24 + 11;
+            }
+
+            uint8_t saturated = 0;
+            saturated |= write_scaled(&offset, dist, 3, 8) ? 0x4 : 0;
+            saturated |= write_scaled(&offset, alt_gain, 3, 6) ? 0x2 : 0;
+            saturated |= write_scaled(&offset, moving_time, 3, 8) ? 0x1 : 0;
+            write_bits(&offset, saturated, 3);
+        }
+
+    private:
+        // Coordinates are in 1e-7 degrees.
+        static constexpr int64_t DEGREE = 10000000;
+
+        // Maps `[-offset..range - offset]` to an unsigned 24 bits integer, rounding to the
+        // nearest unit.
+        static uint32_t quantize(int32_t value, int64_t offset, int64_t range)
+        {
+            constexpr int64_t n_units = 1LL << 24;
+
+            int64_t units = (((int64_t) value + offset) * n_units + range / 2) / range;
+
+            return constrain(units, (int64_t) 0, n_units - 1);
+        }
+
+        // Writes `value` as an exponent and a mantissa. Returns true if it has been saturated.
+        bool write_scaled(size_t *offset, float value, uint8_t exponent_bits, uint8_t mantissa_bits)
+        {
+            const float max_mantissa = (1UL << mantissa_bits) - 1;
+            const uint8_t max_exponent = (1 << exponent_bits) - 1;
+
+            float scaled = max(value, 0.0f);
+            uint8_t exponent = 0;
+            while (exponent < max_exponent && roundf(scaled) > max_mantissa) {
+                scaled /= 2;
+                ++exponent;
+            }
+
+            bool saturated = roundf(scaled) > max_mantissa;
+
+            write_bits(offset, exponent, exponent_bits);
+            write_bits(offset, min(roundf(scaled), max_mantissa), mantissa_bits);
+
+            return saturated;
+        }
+
+        // Writes the `n_bits` least significant bits of `value` at `*offset` (in bits), MSB first.
+        void write_bits(size_t *offset, uint32_t value, uint8_t n_bits)
+        {
+            for (int8_t i = n_bits - 1; i >= 0; --i, ++*offset) {
+                if (value & (1UL << i)) {
+                    data[*offset / 8] |= 0x80 >> (*offset % 8);
+                }
+            }
+        }
+    } __attribute__((packed));
+
+    static_assert(sizeof(location_msg_t) == 12);
+
+    // Successive locations packed in `n_bytes`: the most recent location (the anchor), followed by
+    // the previous locations as quantized deltas.
+    //
+    // Bit layout, most significant bit first:
+    //
+    //   anchor lat   24 bits     In 180/2^24 degrees units (~1.2 m), offset by +90°.
+    //   anchor lng   24 bits     In 360/2^24 degrees units (~1.5 m at 50°), offset by +180°.
+    //   n_deltas      3 bits     The number of deltas following the anchor.
+    //   scale         3 bits     Deltas are in 2^scale anchor units.
+    //   reserved      2 bits
+    //   deltas    n x 8 bits     Signed 4 bits lat. then lng. delta with the next (more recent)
+    //                            location.
+    //
+    // Deltas are computed from the previously decoded location so that quantization errors do not
+    // accumulate: every location is within half a delta unit, 2^(scale - 1) anchor units, from the
+    // actual one (e.g. 20 secs. probes at 30 kph are 167 m, ~140 lat. units, apart, which needs a
+    // scale of 5, and are within ±19 m).
+    //
+    // A track with all bits at 0 does not contain any location.
+    template<size_t n_bytes>
+    struct packed_track_t {
+        static constexpr size_t MAX_POINTS = (n_bytes * 8 - 54) / 8 + 1;
+
+        static_assert(n_bytes * 8 >= 54 && MAX_POINTS <= 8);
+
+        uint8_t data[n_bytes];
+
+        // Constructs the track from `n_points` locations, the most recent first. Only the first
+        // `MAX_POINTS` locations are encoded.
+        template<typename coordinates_t>
+        packed_track_t(const coordinates_t *points, size_t n_points) : data{}
+        {
+            if (n_points == 0) {
+                return;
+            }
+
+            n_points = min(n_points, MAX_POINTS);
+
+            int32_t lats[MAX_POINTS], lngs[MAX_POINTS];
+            for (size_t i = 0; i < n_points; ++i) {
+                lats[i] = quantize(points[i].lat, 90 * DEGREE, 180 * DEGREE);
+                lngs[i] = quantize(points[i].lng, 180 * DEGREE, 360 * DEGREE);
+            }
+
+            // Uses the finest scale for which all deltas fit in 4 bits. Deltas are saturated when
+            // the points are too far apart, even for the largest scale.
+            uint8_t scale = 0;
+            while (
+                scale < MAX_SCALE &&
+                (!deltas_fit(lats, n_points, scale) || !deltas_fit(lngs, n_points, scale))
+            ) {
+                ++scale;
+            }
+
+            size_t offset = 0;
+            write_bits(&offset, lats[0], ANCHOR_BITS);
+            write_bits(&offset, lngs[0], ANCHOR_BITS);
+            write_bits(&offset, n_points - 1, 3);
+            write_bits(&offset, scale, 3);
+            write_bits(&offset, 0, 2);
+
+            int32_t lat = lats[0], lng = lngs[0];
+            for (size_t i = 1; i < n_points; ++i) {
+                write_bits(&offset, next_delta(lats[i], &lat, scale), DELTA_BITS);
+                write_bits(&offset, next_delta(lngs[i], &lng, scale), DELTA_BITS);
+            }
+        }
 
-        // Latest location. Has a 0 value if no valid location.
-        float lat;
-        float lng;
+    private:
+        static constexpr uint8_t ANCHOR_BITS = 24;
+        static constexpr uint8_t DELTA_BITS = 4;
+        static constexpr uint8_t MAX_SCALE = 7;
 
-        // Latest altitude, in meters, divided by 8 (range: [0..2040] m).
-        // Do not go to the Netherlands or the Alps.
-        // Has a 0 value if no valid location.
-        uint8_t alt;
+        static constexpr int32_t MIN_DELTA = -(1 << (DELTA_BITS - 1));
+        static constexpr int32_t MAX_DELTA = (1 << (DELTA_BITS - 1)) - 1;
 
-        // Distance since the last message, in meters per divided by 16 (range: [0..4080] m).
-        uint8_t dist;
+        // Coordinates are in 1e-7 degrees.
+        static constexpr int64_t DEGREE = 10000000;
 
-        // Positive elevation gain, in meters divided by 2 (range: [0..510] m).
-        uint8_t alt_gain;
+        // Maps `[-offset..range - offset]` to an unsigned `ANCHOR_BITS` integer, rounding to the
+        // nearest unit.
+        static int32_t quantize(int32_t value, int64_t offset, int64_t range)
+        {
+            constexpr int64_t n_units = 1LL << ANCHOR_BITS;
+
+            int64_t units = (((int64_t) value + offset) * n_units + range / 2) / range;
+
+            return constrain(units, (int64_t) 0, n_units - 1);
+        }
+
+        // Returns the saturated delta between `value` and `*decoded`, and updates `*decoded` with
+        // the value the receiver will decode.
+        static int32_t next_delta(int32_t value, int32_t *decoded, uint8_t scale)
+        {
+            int32_t unit = 1L << scale;
+            int32_t diff = value - *decoded;
+
+            // Rounds to the nearest unit, away from zero.
+            int32_t delta = (diff >= 0 ? diff + unit / 2 : diff - unit / 2) / unit;
+            delta = constrain(delta, MIN_DELTA, MAX_DELTA);
 
-        // The time in movement, in seconds divived by 8 (range: [0..34] minutes).
-        uint8_t moving_time;
+            *decoded += delta * unit;
+
+            return delta;
+        }
+
+        // Returns true if no delta saturates at the given scale.
+        static bool deltas_fit(const int32_t *values, size_t n_values, uint8_t scale)
+        {
+            int32_t decoded = values[0];
+            for (size_t i = 1; i < n_values; ++i) {
+                next_delta(values[i], &decoded, scale);
+
+                if (abs(values[i] - decoded) > (1L << scale) / 2) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // Writes the `n_bits` least significant bits of `value` at `*offset` (in bits), MSB first.
+        void write_bits(size_t *offset, uint32_t value, uint8_t n_bits)
+        {
+            for (int8_t i = n_bits - 1; i >= 0; --i, ++*offset) {
+                if (value & (1UL << i)) {
+                    data[*offset / 8] |= 0x80 >> (*offset % 8);
+                }
+            }
+        }
+    } __attribute__((packed));
+
+    // Up to 6 successive locations, probed since the previous message.
+    using track_msg_t = packed_track_t<12>;
+
+    // Up to 3 successive locations that could not be sent when they were probed.
+    //
+    // The message is 11 bytes long so that the receiver can distinguish it from the 12 bytes
+    // location messages.
+    struct backlog_msg_t {
+        // Time since the most recent location was probed, in seconds divided by 16 (range:
+        // [0..68] minutes). Saturates for older probes, and for probes of unknown age.
+        uint8_t age;
+
+        // Time between two successive locations, in seconds divided by 8 (range: [0..34] minutes).
+        uint8_t interval;
+
+        packed_track_t<9> track;
+
+        static constexpr size_t MAX_POINTS = decltype(track)::MAX_POINTS;
+
+        // Saturates `age`.
+        static constexpr uint32_t UNKNOWN_AGE = UINT32_MAX;
 
         // Constructs the message with the actual, non scaled, values.
-        location_msg_t(
-            float lat_, float lng_, float alt_,
-            float dist_, float alt_gain_, uint32_t moving_time_) :
-            lat(lat_), lng(lng_), alt(round(alt_ / 8)),
-            dist(round(dist_ / 16)),
-            alt_gain(round(alt_gain_ / 2)),
-            moving_time(round((float) moving_time_ / 8))
+        template<typename coordinates_t>
+        backlog_msg_t(
+            uint32_t age_, uint32_t interval_, const coordinates_t *points, size_t n_points) :
+            age(min(round((float) age_ / 16), 255)),
+            interval(min(round((float) interval_ / 8), 255)),
+            track(points, n_points)
+        { }
+    } __attribute__((packed));
+
+    // The battery voltage, and the charge consumed by each subsystem (see `energy::subsystem_t`)
+    // since the previous telemetry message.
+    //
+    // Bit layout, most significant bit first:
+    //
+    //   battery       8 bits     In 20 mV units (range: [0..5.1] V).
+    //   charges   5 x 14 bits    In mAh multiplied by 10 (range: [0..1638] mAh), saturated.
+    //   reserved      2 bits
+    //
+    // The message is 10 bytes long so that the receiver can distinguish it from the location and
+    // backlog messages.
+    struct telemetry_msg_t {
+        static constexpr uint8_t CHARGE_BITS = 14;
+
+        uint8_t battery;
+        uint8_t charges[(energy::N_SUBSYSTEMS * CHARGE_BITS + 7) / 8];
+
+        // Constructs the message with the actual, non scaled, values.
+        telemetry_msg_t(float battery_, const float (&charge_)[energy::N_SUBSYSTEMS]) :
+            battery(constrain(round(battery_ * 50), 0, 255)), charges{}
+        {
+            constexpr uint32_t max_charge = (1UL << CHARGE_BITS) - 1;
+
+            size_t offset = 0;
+            for (size_t i = 0; i < energy::N_SUBSYSTEMS; ++i) {
+                uint32_t charge = min(round(max(charge_[i], 0.0f) * 10), max_charge);
+
+                for (int8_t bit = CHARGE_BITS - 1; bit >= 0; --bit, ++offset) {
+                    if (charge & (1UL << bit)) {
+                        charges[offset / 8] |= 0x80 >> (offset % 8);
+                    }
+                }
+            }
+        }
+    } __attribute__((packed));
+
+    static_assert(sizeof(telemetry_msg_t) == 10);
+
+    // The tracker status, sent instead of a location message when the location did not change.
+    //
+    // Bit layout, most significant bit first:
+    //
+    //   tracking      1 bit      1 in TRACKING, 0 in POWER_SAVE.
+    //   parked        1 bit      1 if parked in a zone (see `zone_cmd_t`), with the GPS probes
+    //                            suspended.
+    //   motion        1 bit      1 if the movement detector triggered recently.
+    //   n_buffered    5 bits     The probes waiting to be sent as backlog (range: [0..31]),
+    //                            saturated.
+    //   battery       8 bits     In 20 mV units (range: [0..5.1] V).
+    //
+    // The message is 2 bytes long so that the receiver can distinguish it from the other messages.
+    struct heartbeat_msg_t {
+        static constexpr uint8_t TRACKING = 0x80;
+        static constexpr uint8_t PARKED = 0x40;
+        static constexpr uint8_t MOTION = 0x20;
+        static constexpr uint8_t MAX_BUFFERED = 0x1f;
+
+        uint8_t status;
+        uint8_t battery;
+
+        // Constructs the message with the actual, non scaled, values.
+        heartbeat_msg_t(
+            bool tracking, bool parked, bool motion, size_t n_buffered, float battery_) :
+            status(
+                (tracking ? TRACKING : 0) | (parked ? PARKED : 0) | (motion ? MOTION : 0) |
+                min(n_buffered, (size_t) MAX_BUFFERED)),
+            battery(constrain(round(battery_ * 50), 0, 255))
         { }
     } __attribute__((packed));
 
+    static_assert(sizeof(heartbeat_msg_t) == 2);
+
+    // The summary of a trip, from the TRACKING state being entered to the POWER_SAVE state being
+    // entered again, sent once it ended.
+    //
+    // Bit layout, most significant bit first:
+    //
+    //   trip_id       8 bits     Incremented for every trip, wrapping around.
+    //   age           6 bits     Time since the trip ended, in minutes (range: [0..63] minutes),
+    //                            saturated.
+    //   duration     14 bits     In seconds divided by 16 (range: [0..72] hours), saturated.
+    //   moving_time  14 bits     In seconds divided by 16 (range: [0..72] hours), saturated.
+    //   distance     15 bits     In meters divided by 20 (range: [0..655] km), saturated.
+    //   alt_gain      9 bits     Positive elevation gain, in meters divided by 8 (range:
+    //                            [0..4088] m), saturated.
+    //   max_speed     6 bits     The highest speed between two probes, in meters per second
+    //                            multiplied by 2 (range: [0..31.5] m/s), saturated.
+    //
+    // The message is 9 bytes long so that the receiver can distinguish it from the other messages.
+    struct trip_msg_t {
+        uint8_t data[9];
+
+        // Constructs the message with the actual, non scaled, values.
+        trip_msg_t(
+            uint8_t trip_id, uint32_t age, uint32_t duration, uint32_t moving_time,
+            float distance, float alt_gain, float max_speed) :
+            data{}
+        {
+            size_t offset = 0;
+            auto write = [&](uint32_t value, uint8_t n_bits) {
+                value = min(value, (1UL << n_bits) - 1);
+
+                for (int8_t bit = n_bits - 1; bit >= 0; --bit, ++offset) {
+                    if (value & (1UL << bit)) {
+                        data[offset / 8] |= 0x80 >> (offset % 8);
+                    }
+                }
+            };
+
+            write(trip_id, 8);
+            write(round((float) age / 60), 6);
+            write(round((float) duration / 16), 14);
+            write(round((float) moving_time / 16), 14);
+            write(round(max(distance, 0.0f) / 20), 15);
+            write(round(max(alt_gain, 0.0f) / 8), 9);
+            write(round(max(max_speed, 0.0f) * 2), 6);
+        }
+    } __attribute__((packed));
+
+    static_assert(sizeof(trip_msg_t) == 9);
+
+    // Configuration command sent by the backend as the 8 bytes callback response, overriding the
+    // tracker settings at runtime.
+    //
+    // Byte layout, first received byte first:
+    //
+    //   version              `CONFIG_VERSION`. Other responses (e.g. the probe ID echoed by older
+    //                        backends, starting with a 0 byte) are not commands.
+    //   flags                `CONFIG_RESET` restores the profile settings before applying the
+    //                        fields below.
+    //   gps_probe_delay      TRACKING probes delay, in seconds.
+    //   radio_delay          TRACKING messages delay, in seconds divided by 8 (range: [0..34]
+    //                        minutes).
+    //   power_save_delay     POWER_SAVE probes delay, in minutes (range: [0..4.25] hours).
+    //   idle_probes          Idle probes, out of the last `TRACKING_IDLE_BUFFER_SIZE`, to go to
+    //                        POWER_SAVE.
+    //   still_delay          Delay without movement to go to POWER_SAVE, in seconds divided by 8
+    //                        (range: [0..34] minutes).
+    //   forced_tracking      Enters TRACKING and stays in it for this number of minutes, whatever
+    //                        the movements (e.g. to recover a stolen bike).
+    //
+    // Fields with a 0 value are left unchanged.
+    struct config_cmd_t {
+        static constexpr uint8_t CONFIG_VERSION = 1;
+        static constexpr uint8_t CONFIG_RESET = 0x01;
+
+        uint8_t version;
+        uint8_t flags;
+        uint8_t gps_probe_delay;
+        uint8_t radio_delay;
+        uint8_t power_save_delay;
+        uint8_t idle_probes;
+        uint8_t still_delay;
+        uint8_t forced_tracking;
+
+        // Decodes the callback response. Returns nothing if it is not a command of the supported
+        // version.
+        static etl::optional<config_cmd_t> decode(uint64_t response)
+        {
+            uint8_t bytes[sizeof(config_cmd_t)];
+            for (size_t i = 0; i < sizeof(bytes); ++i) {
+                bytes[i] = (response >> (8 * (sizeof(bytes) - 1 - i))) & 0xff;
+            }
+
+            if (bytes[0] != CONFIG_VERSION) {
+                return etl::nullopt;
+            }
+
+            config_cmd_t cmd;
+            memcpy(&cmd, bytes, sizeof(cmd));
+            return cmd;
+        }
+    } __attribute__((packed));
+
+    static_assert(sizeof(config_cmd_t) == sizeof(uint64_t));
+
+    // Parking zone command, sent by the backend as the 8 bytes callback response, setting or
+    // removing one of the tracker's parking zones.
+    //
+    // Byte layout, first received byte first:
+    //
+    //   version              `ZONE_VERSION`.
+    //   slot and radius      The index of the zone in the table (3 high bits), and its radius in
+    //                        steps of `RADIUS_STEP` meters (5 low bits, range: [0..775] meters). A
+    //                        0 radius removes the zone.
+    //   lat                  Latitude of the center, 3 bytes, big endian, as a fraction of
+    //                        [-90..90] degrees (~1.2 meters precision).
+    //   lng                  Longitude of the center, 3 bytes, big endian, as a fraction of
+    //                        [-180..180] degrees (~2.4 meters precision at the equator).
+    struct zone_cmd_t {
+        static constexpr uint8_t ZONE_VERSION = 2;
+        static constexpr uint32_t RADIUS_STEP = 25; // meters
+
+        uint8_t slot;
+        uint32_t radius;                // meters
+        gps_t::coordinates_t center;
+
+        // Decodes the callback response. Returns nothing if it is not a zone command.
+        static etl::optional<zone_cmd_t> decode(uint64_t response)
+        {
+            if ((response >> 56) != ZONE_VERSION) {
+                return etl::nullopt;
+            }
+
+            uint8_t slot_radius = (response >> 48) & 0xff;
+            uint32_t lat = (response >> 24) & 0xffffff;
+            uint32_t lng = response & 0xffffff;
+
+            zone_cmd_t cmd;
+            cmd.slot = slot_radius >> 5;
+            cmd.radius = (slot_radius & 0x1f) * RADIUS_STEP;
+            cmd.center = gps_t::coordinates_t{
+                unquantize(lat, 90 * DEGREE, 180 * DEGREE),
+                unquantize(lng, 180 * DEGREE, 360 * DEGREE),
+                0,
+            };
+            return cmd;
+        }
+
+    private:
+        static constexpr uint8_t COORDINATE_BITS = 24;
+
+        // Coordinates are in 1e-7 degrees.
+        static constexpr int64_t DEGREE = 10000000;
+
+        // Maps an unsigned `COORDINATE_BITS` integer back to `[-offset..range - offset]`.
+        static int32_t unquantize(uint32_t value, int64_t offset, int64_t range)
+        {
+            constexpr int64_t n_units = 1LL << COORDINATE_BITS;
+
+            return (value * range + n_units / 2) / n_units - offset;
+        }
+    };
+
+    // SigFox uplinks and downlinks quotas are daily.
+    static constexpr uint32_t QUOTA_WINDOW = 24 * 60 * 60; // sec
+
+    // Each SigFox frame is sent 3 times at 100 bps, with 14 bytes of protocol overhead.
+    static constexpr uint32_t airtime(size_t msg_size) // ms
+    {
+        return (msg_size + 14) * 8 * 10 * 3;
+    }
+
+    // A downlink request keeps the modem busy for up to about 50 seconds: after the uplink, it waits
+    // 20 seconds for the network, then listens for up to 25 seconds.
+    static constexpr uint32_t DOWNLINK_DURATION = 50; // sec
+
     void
     setup()
     {
-        wake_up();
+        if (!wake_up()) {
+            return;
+        }
 
-        logger::info(
-            "\tAtm version: " + SigFox.AtmVersion() + " - " +
-            "SigFox version: " + SigFox.SigVersion() + " " +
-            "ID: " + SigFox.ID() + " " +
-            "PA: " + SigFox.PAC() + " " +
-            "Status: " + String(SigFox.statusCode(SIGFOX), HEX) + " - " +
-            "Temp.: " + SigFox.internalTemperature() + "C°");
+        if constexpr (logger::LEVEL >= logger::level_t::INFO) {
+            logger::info(
+                "\tAtm version: ", SigFox.AtmVersion(), " - ",
+                "SigFox version: ", SigFox.SigVersion(), " ",
+                "ID: ", SigFox.ID(), " ",
+                "PA: ", SigFox.PAC(), " ",
+                "Status: ", logger::hex(SigFox.statusCode(SIGFOX)), " - ",
+                "Temp.: ", SigFox.internalTemperature(), "C°");
+        }
 
         sleep();
     }
 
-    // Sends the given message.
+    // Sends the given message, requesting a downlink if `request_downlink` is true.
+    //
+    // On succes, returns the 8 byte callback response, or 0 if no downlink has been requested.
     //
-    // On succes, returns a 8 byte callback response.
+    // Requesting a downlink keeps the modem busy for up to `DOWNLINK_DURATION`, and fails if the
+    // backend does not answer.
     template<typename msg_t>
     etl::optional<uint64_t>
-    send(const msg_t &msg)
+    send(const msg_t &msg, bool request_downlink = false)
     {
         static_assert(sizeof(msg) <= 12);
 
-        logger::info("Sending " + String(sizeof(msg)) + " byte(s) message:");
+        logger::info(
+            "Sending ", sizeof(msg), " byte(s) message", request_downlink ? " (downlink)" : "", ":");
 
         const byte *msg_bytes = reinterpret_cast<const byte *>(&msg);
 
-        {
-            String msg_hex;
-            for (size_t i = 0; i < sizeof(msg); ++i) {
-                msg_hex += String(msg_bytes[i], HEX) + " ";
-            }
-            logger::info("\t" + msg_hex);
-        }
+        logger::info("\t", logger::bytes(msg_bytes, sizeof(msg)));
 
-        wake_up();
+        if (!wake_up()) {
+            return etl::nullopt;
+        }
 
         // Entering debug mode prevents a issue with the SigFox library, by disabling low power
         // optimisations.
@@ -93,16 +582,31 @@ public:
 
         SigFox.write(msg_bytes, sizeof(msg));
 
-        bool status = SigFox.endPacket(true);
+        uint32_t started_at = energy::now_ms();
+
+        bool status = SigFox.endPacket(request_downlink);
+
+        // The modem listens for the downlink once the frames are sent.
+        {
+            uint32_t duration = energy::now_ms() - started_at;
+            uint32_t tx_duration = min(duration, airtime(sizeof(msg)));
+
+            energy::add(energy::subsystem_t::RADIO_TX, tx_duration);
+            energy::add(energy::subsystem_t::RADIO_RX, duration - tx_duration);
+        }
 
         etl::optional<uint64_t> response;
 
         if (status != 0) {
             logger::warning(
-                "Error while transmitting SigFox paquet (status: 0x" + String(status, HEX) + ")");
+                "Error while transmitting SigFox paquet (status: 0x", logger::hex(status), ")");
+        } else if (!request_downlink) {
+            response.emplace(0);
         } else {
             uint64_t value{0};
-            String value_str = String();
+
+            byte value_bytes[sizeof(value)];
+            size_t n_bytes = 0;
 
             while (SigFox.available()) {
                 byte byte_val = (byte) SigFox.read();
@@ -110,10 +614,12 @@ public:
                 value <<= 8;
                 value |= byte_val;
 
-                value_str += String(byte_val, HEX);
+                if (n_bytes < sizeof(value_bytes)) {
+                    value_bytes[n_bytes++] = byte_val;
+                }
             }
 
-            logger::info("Received callback response: 0x" + value_str);
+            logger::info("Received callback response: ", logger::bytes(value_bytes, n_bytes));
 
             response.emplace(value);
         }
@@ -124,13 +630,16 @@ public:
         return response;
     }
 
-    void
+    // Returns false if the modem does not answer.
+    bool
     wake_up()
     {
         if (!SigFox.begin()) {
             logger::error("Unable to wake-up SigFox module.");
+            return false;
         }
         logger::info("SigFox module initialized.");
+        return true;
     }
 
     void
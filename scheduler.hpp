@@ -0,0 +1,164 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <etl/optional.h>
+
+namespace bike_tracker {
+
+// Schedules the tasks of `task_t`, an enumeration of `n_tasks` values, at RTC epoch times (in
+// secs).
+//
+// Each task is scheduled at most once. The scheduled tasks are kept in a binary min-heap, so that
+// the next task is known in constant time, and scheduling or cancelling a task is logarithmic.
+template<typename task_t, size_t n_tasks>
+class scheduler_t {
+public:
+    scheduler_t()
+    {
+        for (size_t &pos : positions_) {
+            pos = NONE;
+        }
+    }
+
+    // Schedules the task at `time`, replacing its previous schedule if any.
+    void schedule(task_t task, uint32_t time)
+    {
+        size_t pos = positions_[index(task)];
+
+        if (pos == NONE) {
+            pos = size_++;
+            heap_[pos] = entry_t{time, task};
+            positions_[index(task)] = pos;
+        } else {
+            heap_[pos].time = time;
+        }
+
+        sift_down(sift_up(pos));
+    }
+
+    void cancel(task_t task)
+    {
+        size_t pos = positions_[index(task)];
+
+        if (pos == NONE) {
+            return;
+        }
+
+        positions_[index(task)] = NONE;
+        --size_;
+
+        if (pos < size_) {
+            // Moves the last entry in place of the removed one.
+            heap_[pos] = heap_[size_];
+            positions_[index(heap_[pos].task)] = pos;
+
+            sift_down(sift_up(pos));
+        }
+    }
+
+    // Returns the time at which the task is scheduled, if any.
+    etl::optional<uint32_t> time(task_t task) const
+    {
+        size_t pos = positions_[index(task)];
+
+        if (pos == NONE) {
+            return etl::nullopt;
+        } else {
+            return heap_[pos].time;
+        }
+    }
+
+    // Returns the time of the earliest scheduled task, if any.
+    etl::optional<uint32_t> next_time() const
+    {
+        if (size_ == 0) {
+            return etl::nullopt;
+        } else {
+            return heap_[0].time;
+        }
+    }
+
+    // Removes and returns the earliest task scheduled at or before `now`, if any.
+    //
+    // Tasks scheduled at the same time are returned in the order of their `task_t` value.
+    etl::optional<task_t> pop_due(uint32_t now)
+    {
+        if (size_ == 0 || heap_[0].time > now) {
+            return etl::nullopt;
+        }
+
+        task_t task = heap_[0].task;
+        cancel(task);
+
+        return task;
+    }
+
+private:
+    static constexpr size_t NONE = n_tasks;
+
+    struct entry_t {
+        uint32_t time;
+        task_t task;
+    };
+
+    entry_t heap_[n_tasks];
+    size_t size_{0};
+
+    // The position of each task in `heap_`, or `NONE` if not scheduled.
+    size_t positions_[n_tasks];
+
+    static constexpr size_t index(task_t task)
+    {
+        return static_cast<size_t>(task);
+    }
+
+    static bool before(const entry_t &a, const entry_t &b)
+    {
+        return a.time < b.time || (a.time == b.time && index(a.task) < index(b.task));
+    }
+
+    void swap(size_t pos_a, size_t pos_b)
+    {
+        entry_t entry = heap_[pos_a];
+        heap_[pos_a] = heap_[pos_b];
+        heap_[pos_b] = entry;
+
+        positions_[index(heap_[pos_a].task)] = pos_a;
+        positions_[index(heap_[pos_b].task)] = pos_b;
+    }
+
+    // Moves the entry up until its parent is before it. Returns its new position.
+    size_t sift_up(size_t pos)
+    {
+        while (pos > 0 && before(heap_[pos], heap_[(pos - 1) / 2])) {
+            swap(pos, (pos - 1) / 2);
+            pos = (pos - 1) / 2;
+        }
+        return pos;
+    }
+
+    // Moves the entry down until it is before its children.
+    void sift_down(size_t pos)
+    {
+        for (;;) {
+            size_t first = pos;
+
+            for (size_t child = 2 * pos + 1; child <= 2 * pos + 2 && child < size_; ++child) {
+                if (before(heap_[child], heap_[first])) {
+                    first = child;
+                }
+            }
+
+            if (first == pos) {
+                return;
+            }
+
+            swap(pos, first);
+            pos = first;
+        }
+    }
+};
+
+}
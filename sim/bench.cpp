@@ -0,0 +1,118 @@
+// Compares `gps_t::distance()` with `gps_t::haversine_distance()`: the time per call, and the
+// error relative to a double precision haversine, on random pairs of coordinates at cycling
+// distances.
+//
+// The host has an FPU, unlike the SAMD21: the speedup on the tracker, where every float operation
+// is emulated, is larger than reported here.
+//
+// Usage: bench_distance [<max distance in meters>]
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include <Arduino.h>
+
+#include "../gps.hpp"
+
+namespace {
+
+using bike_tracker::gps_t;
+
+constexpr size_t N_PAIRS = 4096;
+constexpr size_t N_ROUNDS = 256;
+
+constexpr double MAX_LATITUDE = 70.0; // degrees
+
+struct pair_t {
+    gps_t::coordinates_t a;
+    gps_t::coordinates_t b;
+};
+
+double reference_distance(const pair_t &pair)
+{
+    constexpr double earth_radius = 6371.0 * 1000.0;
+    constexpr double to_radians = M_PI / 180.0;
+
+    double lat_a = pair.a.lat * 1e-7 * to_radians, lat_b = pair.b.lat * 1e-7 * to_radians;
+    double delta_lat = lat_a - lat_b;
+    double delta_lng = ((double) pair.a.lng - pair.b.lng) * 1e-7 * to_radians;
+
+    double h = pow(sin(delta_lat / 2), 2) + cos(lat_a) * cos(lat_b) * pow(sin(delta_lng / 2), 2);
+
+    return 2 * atan2(sqrt(h), sqrt(1 - h)) * earth_radius;
+}
+
+// Returns the time per call of `distance`, in nanoseconds.
+template<typename distance_t>
+double time_per_call(const std::vector<pair_t> &pairs, distance_t distance)
+{
+    volatile float sink = 0;
+
+    auto started_at = std::chrono::steady_clock::now();
+
+    for (size_t round = 0; round < N_ROUNDS; ++round) {
+        for (const pair_t &pair : pairs) {
+            sink = sink + distance(pair.a, pair.b, true);
+        }
+    }
+
+    std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - started_at;
+
+    return elapsed.count() / (N_ROUNDS * pairs.size());
+}
+
+// Returns the maximal absolute error of `distance`, in meters.
+template<typename distance_t>
+double max_error(const std::vector<pair_t> &pairs, distance_t distance)
+{
+    double error = 0;
+    for (const pair_t &pair : pairs) {
+        error = std::max(error, fabs(distance(pair.a, pair.b, true) - reference_distance(pair)));
+    }
+    return error;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    double max_distance = argc > 1 ? atof(argv[1]) : 1000.0;
+
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+    std::vector<pair_t> pairs(N_PAIRS);
+    for (pair_t &pair : pairs) {
+        double lat = (uniform(rng) * 2 - 1) * MAX_LATITUDE;
+        double lng = (uniform(rng) * 2 - 1) * 179.0;
+        double dist = uniform(rng) * max_distance;
+        double bearing = uniform(rng) * 2 * M_PI;
+
+        // About 111.2 km per degree of latitude.
+        double lat_b = lat + dist * cos(bearing) / 111195.0;
+        double lng_b = lng + dist * sin(bearing) / 111195.0 / cos(lat * M_PI / 180.0);
+
+        pair.a = gps_t::coordinates_t{(int32_t) lround(lat * 1e7), (int32_t) lround(lng * 1e7), 0};
+        pair.b = gps_t::coordinates_t{
+            (int32_t) lround(lat_b * 1e7), (int32_t) lround(lng_b * 1e7), 0
+        };
+    }
+
+    double haversine_ns = time_per_call(pairs, gps_t::haversine_distance);
+    double distance_ns = time_per_call(pairs, gps_t::distance);
+
+    printf("Distances up to %.0f m, latitudes up to %.0f°:\n", max_distance, MAX_LATITUDE);
+    printf(
+        "haversine_distance: %6.1f ns/call - max error: %.4f m\n",
+        haversine_ns, max_error(pairs, gps_t::haversine_distance));
+    printf(
+        "distance:           %6.1f ns/call - max error: %.4f m (%.1fx faster)\n",
+        distance_ns, max_error(pairs, gps_t::distance), haversine_ns / distance_ns);
+
+    return EXIT_SUCCESS;
+}
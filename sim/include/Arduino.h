@@ -0,0 +1,201 @@
+#pragma once
+
+// Host-side replacement for the Arduino core, only covering what the tracker uses.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <string>
+#include <type_traits>
+
+#include "sim.hpp"
+
+typedef uint8_t byte;
+typedef uint32_t pin_size_t;
+
+enum { LOW = 0, HIGH = 1 };
+enum { INPUT = 0, OUTPUT = 1, INPUT_PULLUP = 2 };
+enum { CHANGE = 2, FALLING = 3, RISING = 4 };
+enum { DEC = 10, HEX = 16 };
+
+constexpr pin_size_t LED_BUILTIN = 6;
+constexpr pin_size_t A1 = 16;
+constexpr pin_size_t ADC_BATTERY = 32;
+
+enum { AR_DEFAULT = 0 };
+
+template<class T, class L>
+auto min(const T &a, const L &b) -> decltype((b < a) ? b : a) { return (b < a) ? b : a; }
+
+template<class T, class L>
+auto max(const T &a, const L &b) -> decltype((b < a) ? b : a) { return (a < b) ? b : a; }
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+class String : public std::string {
+public:
+    String() = default;
+    String(const char *s) : std::string(s) { }
+    String(const std::string &s) : std::string(s) { }
+    String(char c) : std::string(1, c) { }
+    String(int v, int base = DEC) : std::string(format((long long) v, base)) { }
+    String(unsigned v, int base = DEC) : std::string(format((long long) v, base)) { }
+    String(long v, int base = DEC) : std::string(format((long long) v, base)) { }
+    String(unsigned long v, int base = DEC) : std::string(format((long long) v, base)) { }
+    String(float v, int digits = 2) : std::string(format_fp(v, digits)) { }
+    String(double v, int digits = 2) : std::string(format_fp(v, digits)) { }
+
+private:
+    static std::string format(long long v, int base)
+    {
+        char buf[32];
+        snprintf(buf, sizeof(buf), base == HEX ? "%llx" : "%lld", v);
+        return buf;
+    }
+
+    static std::string format_fp(double v, int digits)
+    {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%.*f", digits, v);
+        return buf;
+    }
+};
+
+template<typename T, typename = std::enable_if_t<std::is_arithmetic_v<T>>>
+inline String operator+(const std::string &a, T v)
+{
+    return String(a + String(v));
+}
+
+class Print {
+public:
+    virtual ~Print() = default;
+
+    virtual size_t write(uint8_t c) = 0;
+
+    size_t write(const uint8_t *buf, size_t size)
+    {
+        for (size_t i = 0; i < size; ++i) {
+            write(buf[i]);
+        }
+        return size;
+    }
+
+    size_t print(const char *s) { return write(reinterpret_cast<const uint8_t *>(s), strlen(s)); }
+    size_t print(const String &s) { return print(s.c_str()); }
+    size_t print(char c) { return write((uint8_t) c); }
+    size_t print(int v, int base = DEC) { return print(String(v, base)); }
+    size_t print(unsigned v, int base = DEC) { return print(String(v, base)); }
+    size_t print(long v, int base = DEC) { return print(String(v, base)); }
+    size_t print(unsigned long v, int base = DEC) { return print(String(v, base)); }
+    size_t print(double v, int digits = 2) { return print(String(v, digits)); }
+
+    size_t println() { return print("\n"); }
+
+    template<typename T>
+    size_t println(const T &v) { return print(v) + println(); }
+
+    template<typename T>
+    size_t println(const T &v, int fmt) { return print(v, fmt) + println(); }
+};
+
+// Written bytes go to the device attached with `attach()` if any, or to the standard error output
+// if verbose.
+class HardwareSerial : public Print {
+public:
+    void begin(unsigned long baud) { baud_ = baud; }
+    void end() { }
+
+    unsigned long baud() const { return baud_; }
+
+    explicit operator bool() const { return true; }
+
+    void attach(std::function<void(uint8_t)> device) { device_ = std::move(device); }
+
+    // Bytes sent by the attached device.
+    void receive(uint8_t c) { rx_.push_back(c); }
+
+    int available() const { return (int) rx_.size(); }
+
+    int read()
+    {
+        if (rx_.empty()) {
+            return -1;
+        }
+
+        uint8_t c = rx_.front();
+        rx_.pop_front();
+        return c;
+    }
+
+    size_t write(uint8_t c) override
+    {
+        if (device_) {
+            device_(c);
+        } else if (sim::world.verbose) {
+            fputc(c, stderr);
+        }
+        return 1;
+    }
+
+    using Print::write;
+
+private:
+    unsigned long baud_{0};
+
+    std::function<void(uint8_t)> device_;
+    std::deque<uint8_t> rx_;
+};
+
+using Uart = HardwareSerial;
+
+inline HardwareSerial Serial;
+inline HardwareSerial Serial1;
+
+// Like on the SAMD21, the SysTick based clock does not advance while sleeping.
+inline unsigned long millis() { return sim::world.now_ms - sim::world.sleep_ms; }
+inline unsigned long micros() { return millis() * 1000; }
+inline void delay(unsigned long ms) { sim::world.advance(ms, sim::world.awake_ms); }
+
+inline void pinMode(pin_size_t, int) { }
+inline void digitalWrite(pin_size_t, int) { }
+inline int digitalRead(pin_size_t) { return HIGH; }
+
+// Only the battery voltage is connected, through the board's 330 kΩ / 1 MΩ divider, the ADC using
+// the 3.3 V reference.
+inline uint8_t adc_bits_ = 10;
+
+inline void analogReference(int) { }
+inline void analogReadResolution(int bits) { adc_bits_ = bits; }
+
+inline int analogRead(pin_size_t pin)
+{
+    if (pin != ADC_BATTERY) {
+        return 0;
+    }
+
+    double ratio = sim::world.battery_voltage * 1000.0 / 1330.0 / 3.3;
+    return std::clamp((int) lround(ratio * ((1 << adc_bits_) - 1)), 0, (1 << adc_bits_) - 1);
+}
+
+inline int digitalPinToInterrupt(pin_size_t pin) { return pin; }
+
+// The simulated world triggers the interrupt handler when the replayed ride moves, or the one of
+// the button when pressed.
+inline void attachInterrupt(int pin, void (*handler)(), int)
+{
+    (pin == sim::BUTTON_PIN ? sim::world.button_interrupt : sim::world.interrupt) = handler;
+}
+
+inline void detachInterrupt(int pin)
+{
+    (pin == sim::BUTTON_PIN ? sim::world.button_interrupt : sim::world.interrupt) = nullptr;
+}
+
+// The simulated interrupts are only delivered while sleeping, masking them does nothing.
+inline void __disable_irq() { }
+inline void __enable_irq() { }
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "Arduino.h"
+
+// Sleeps by moving the simulated clock forward, waking up early on interrupts or on the RTC alarm.
+class ArduinoLowPowerClass {
+public:
+    void attachInterruptWakeup(int pin, void (*handler)(), int mode)
+    {
+        attachInterrupt(pin, handler, mode);
+    }
+
+    void sleep(unsigned long ms)
+    {
+        ++sim::world.n_wake_ups;
+
+        sim::world.interrupted = false;
+
+        while (ms > 0 && !sim::world.interrupted) {
+            unsigned long step = std::min(ms, 1000ul);
+            sim::world.advance(step, sim::world.sleep_ms);
+            ms -= step;
+        }
+    }
+
+    // Sleeps until an interrupt or the RTC alarm, or the end of the ride.
+    void sleep()
+    {
+        ++sim::world.n_wake_ups;
+
+        sim::world.interrupted = false;
+
+        while (!sim::world.interrupted && !sim::world.finished()) {
+            uint64_t until_alarm = sim::world.until_rtc_alarm();
+
+            if (sim::world.rtc_alarm_enabled && until_alarm == 0) {
+                return;
+            }
+
+            uint64_t step = sim::world.rtc_alarm_enabled ? std::min<uint64_t>(until_alarm, 1000) : 1000;
+            sim::world.advance(step, sim::world.sleep_ms);
+        }
+    }
+};
+
+inline ArduinoLowPowerClass LowPower;
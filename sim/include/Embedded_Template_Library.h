@@ -0,0 +1,3 @@
+#pragma once
+
+// The actual ETL headers are taken from `ETL_DIR`, see the Makefile.
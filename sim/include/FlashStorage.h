@@ -0,0 +1,33 @@
+#pragma once
+
+// Simulated SAMD21 flash, kept in RAM for the duration of the simulation.
+//
+// Like the actual library, `FlashStorage()` reserves a static buffer, and declares a handle to it,
+// which can be copied.
+
+#include <cstring>
+
+#include "Arduino.h"
+
+template<class T>
+class FlashStorageClass {
+public:
+    explicit FlashStorageClass(uint8_t *data) : data_(data) { }
+
+    void write(const T &data)
+    {
+        memcpy(data_, &data, sizeof(T));
+    }
+
+    void read(T *data)
+    {
+        memcpy(data, data_, sizeof(T));
+    }
+
+private:
+    uint8_t *data_;
+};
+
+#define FlashStorage(name, T)                                                                    \
+    static uint8_t name##_data[sizeof(T)] = { };                                                 \
+    FlashStorageClass<T> name(name##_data)
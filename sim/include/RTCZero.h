@@ -0,0 +1,36 @@
+#pragma once
+
+#include "Arduino.h"
+
+// Simulated RTC, possibly drifting from the simulated clock (see `sim::world_t::rtc_drift_ppm`).
+class RTCZero {
+public:
+    enum Alarm_Match : uint8_t {
+        MATCH_OFF, MATCH_SS, MATCH_MMSS, MATCH_HHMMSS, MATCH_DHHMMSS, MATCH_MMDDHHMMSS,
+        MATCH_YYMMDDHHMMSS
+    };
+
+    void begin() { }
+
+    uint32_t getY2kEpoch() { return sim::world.rtc_ms() / 1000; }
+
+    // Like the actual RTC, keeps the fraction of the current second.
+    void setY2kEpoch(uint32_t ts)
+    {
+        int64_t rtc_ms = sim::world.rtc_ms();
+        sim::world.rtc_offset_ms += (int64_t) ts * 1000 - rtc_ms + rtc_ms % 1000;
+    }
+
+    // Unix epoch.
+    void setAlarmEpoch(uint32_t ts)
+    {
+        sim::world.rtc_alarm_ms = ((int64_t) ts - EPOCH_TIME_OFF) * 1000;
+    }
+
+    void enableAlarm(Alarm_Match match) { sim::world.rtc_alarm_enabled = match != MATCH_OFF; }
+    void disableAlarm() { sim::world.rtc_alarm_enabled = false; }
+
+private:
+    // Unix epoch of 2000-01-01.
+    static constexpr int64_t EPOCH_TIME_OFF = 946684800;
+};
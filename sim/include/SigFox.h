@@ -0,0 +1,93 @@
+#pragma once
+
+// Simulated SigFox modem, recording the uplinks and their airtime.
+
+#include <algorithm>
+#include <array>
+
+#include "Arduino.h"
+
+constexpr int SIGFOX = 0;
+
+class SigFoxClass {
+public:
+    // Each frame is sent 3 times at 100 bps, with 14 bytes of protocol overhead. When a downlink is
+    // requested, the modem then waits 20 secs, and listens for 25 secs (see
+    // `radio_t::DOWNLINK_DURATION`).
+    static constexpr uint64_t BIT_MS = 10;
+    static constexpr uint64_t FRAME_OVERHEAD = 14;
+    static constexpr uint64_t FRAME_REPEATS = 3;
+    static constexpr uint64_t DOWNLINK_DELAY_MS = 20 * 1000;
+    static constexpr uint64_t DOWNLINK_WINDOW_MS = 25 * 1000;
+
+    bool begin() { return true; }
+    void end() { }
+
+    void debug() { }
+    void noDebug() { }
+
+    String AtmVersion() { return "sim"; }
+    String SigVersion() { return "sim"; }
+    String ID() { return "00000000"; }
+    String PAC() { return "0000000000000000"; }
+    int statusCode(int) { return 0; }
+    float internalTemperature() { return 20.0f; }
+
+    void beginPacket() { payload_.clear(); }
+
+    size_t write(const uint8_t *data, size_t size)
+    {
+        payload_.insert(payload_.end(), data, data + size);
+        return size;
+    }
+
+    int endPacket(bool downlink = false)
+    {
+        uint64_t tx_ms = (payload_.size() + FRAME_OVERHEAD) * 8 * BIT_MS * FRAME_REPEATS;
+        sim::world.advance(tx_ms, sim::world.radio_tx_ms);
+
+        if (downlink) {
+            // The firmware accounts for the whole wait as `energy::subsystem_t::RADIO_RX`.
+            sim::world.advance(DOWNLINK_DELAY_MS + DOWNLINK_WINDOW_MS, sim::world.radio_rx_ms);
+        }
+
+        bool delivered = sim::world.has_coverage();
+
+        sim::world.uplinks.push_back(
+            sim::uplink_t{sim::world.now_ms, payload_, downlink, delivered});
+
+        // Answers with the next pending downlink, or with an empty 8 byte response.
+        response_ = delivered && downlink ? 8 : 0;
+        response_data_ = {};
+
+        if (response_ > 0) {
+            std::vector<sim::downlink_t> &downlinks = sim::world.downlinks;
+            auto pending = std::find_if(
+                downlinks.begin(), downlinks.end(),
+                [](const sim::downlink_t &d) { return d.time * 1000ull <= sim::world.now_ms; });
+
+            if (pending != downlinks.end()) {
+                std::copy(pending->data, pending->data + 8, response_data_.begin());
+                downlinks.erase(pending);
+            }
+        }
+
+        return delivered ? 0 : 1;
+    }
+
+    int available() { return response_; }
+
+    int read()
+    {
+        return response_data_[8 - response_--];
+    }
+
+private:
+    std::vector<uint8_t> payload_;
+
+    std::array<uint8_t, 8> response_data_{};
+
+    int response_{0};
+};
+
+inline SigFoxClass SigFox;
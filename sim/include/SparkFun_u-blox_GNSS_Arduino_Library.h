@@ -0,0 +1,468 @@
+#pragma once
+
+// Simulated u-blox receiver, reporting the replayed ride position once it got a fix.
+//
+// The UBX frames written to its serial port by the firmware itself, not through the library, are
+// parsed too. Only the batching of the fixes (CFG-BATCH and LOG-RETRIEVEBATCH) is emulated.
+
+#include <random>
+#include <vector>
+
+#include "Arduino.h"
+
+enum sfe_ublox_gnss_ids_e {
+    SFE_UBLOX_GNSS_ID_GPS,
+    SFE_UBLOX_GNSS_ID_SBAS,
+    SFE_UBLOX_GNSS_ID_GALILEO,
+    SFE_UBLOX_GNSS_ID_BEIDOU,
+    SFE_UBLOX_GNSS_ID_IMES,
+    SFE_UBLOX_GNSS_ID_QZSS,
+    SFE_UBLOX_GNSS_ID_GLONASS
+};
+
+// Subset of the NAV-PVT frame fields.
+struct UBX_NAV_PVT_data_t {
+    uint16_t year;
+    uint8_t month;
+    uint8_t day;
+    uint8_t hour;
+    uint8_t min;
+    uint8_t sec;
+
+    union {
+        uint8_t all;
+        struct {
+            uint8_t validDate : 1;
+            uint8_t validTime : 1;
+            uint8_t fullyResolved : 1;
+            uint8_t validMag : 1;
+        } bits;
+    } valid;
+
+    uint8_t fixType;
+
+    union {
+        uint8_t all;
+        struct {
+            uint8_t gnssFixOK : 1;
+            uint8_t diffSoln : 1;
+            uint8_t psmState : 3;
+            uint8_t headVehValid : 1;
+            uint8_t carrSoln : 2;
+        } bits;
+    } flags;
+
+    uint8_t numSV;
+    int32_t lon;    // 1e-7 deg
+    int32_t lat;    // 1e-7 deg
+    int32_t height; // mm
+    int32_t hMSL;   // mm
+    uint32_t hAcc;  // mm
+    uint32_t vAcc;  // mm
+    int32_t gSpeed; // mm/s
+    int32_t headMot; // 1e-5 deg
+    uint16_t pDOP;  // 0.01
+};
+
+struct UBX_NAV_PVT_t {
+    UBX_NAV_PVT_data_t data;
+};
+
+constexpr uint8_t COM_PORT_UART1 = 1;
+
+constexpr uint8_t COM_TYPE_UBX = 1 << 0;
+constexpr uint8_t COM_TYPE_NMEA = 1 << 1;
+
+constexpr uint32_t VAL_CFG_SUBSEC_IOPORT = 0x00000001;
+constexpr uint32_t VAL_CFG_SUBSEC_MSGCONF = 0x00000002;
+constexpr uint32_t VAL_CFG_SUBSEC_NAVCONF = 0x00000008;
+constexpr uint32_t VAL_CFG_SUBSEC_RXMCONF = 0x00000010;
+
+class SFE_UBLOX_GNSS {
+public:
+    UBX_NAV_PVT_t *packetUBXNAVPVT{nullptr};
+
+    // Fails after `max_wait` ms if the port does not use the module's baud rate, or if the module
+    // does not answer (see `sim::world_t::gnss_unresponsive`).
+    bool begin(HardwareSerial &serial, uint16_t max_wait = BEGIN_TIMEOUT_MS)
+    {
+        if (serial.baud() != config_.baud || sim::world.gnss_is_unresponsive()) {
+            sim::world.advance(max_wait, sim::world.awake_ms);
+            return false;
+        }
+
+        if (!sim::world.gnss_on) {
+            sim::world.gnss_power_on(sim::world.now_ms);
+        }
+
+        serial_ = &serial;
+        serial.attach([this](uint8_t c) { parse(c); });
+
+        return true;
+    }
+
+    uint8_t getProtocolVersionHigh() { return sim::world.gnss_batching ? 23 : 18; }
+
+    bool setMeasurementRate(uint16_t rate)
+    {
+        measurement_rate_ms_ = rate;
+        return true;
+    }
+
+    // Changing the enabled constellations restarts the receiver.
+    bool enableGNSS(bool enabled, sfe_ublox_gnss_ids_e id)
+    {
+        if (config_.gnss[id] != enabled) {
+            config_.gnss[id] = enabled;
+            sim::world.gnss_cold_restart();
+        }
+        return true;
+    }
+
+    bool isGNSSenabled(sfe_ublox_gnss_ids_e id) { return config_.gnss[id]; }
+
+    bool powerSaveMode(bool enabled)
+    {
+        power_save_ = enabled;
+        return true;
+    }
+
+    uint8_t getPowerSaveMode() { return power_save_; }
+
+    bool setSerialRate(uint32_t baud, uint8_t = COM_PORT_UART1)
+    {
+        config_.baud = baud;
+        return true;
+    }
+
+    bool setUART1Output(uint8_t com_settings)
+    {
+        config_.nmea = com_settings & COM_TYPE_NMEA;
+        return true;
+    }
+
+    bool saveConfigSelective(uint32_t)
+    {
+        saved_config_ = config_;
+        return true;
+    }
+
+    // Software backup mode, for `duration` ms or until the next `begin()` if 0. The module
+    // restarts with the saved configuration.
+    bool powerOff(uint32_t duration)
+    {
+        sim::world.gnss_power_off(duration);
+        config_ = saved_config_;
+
+        batching_ = false;
+        measurement_rate_ms_ = 1000;
+
+        return true;
+    }
+
+    bool setAutoPVT(bool enabled)
+    {
+        auto_pvt_ = enabled;
+        return true;
+    }
+
+    // Polls a single NAV-PVT frame.
+    bool getPVT()
+    {
+        if (!sim::world.gnss_on) {
+            return false;
+        }
+
+        fresh_[FIX_OK] = false;
+        poll(FIX_OK);
+
+        packetUBXNAVPVT = &pvt_;
+
+        UBX_NAV_PVT_data_t &data = pvt_.data;
+        struct tm t = tm();
+
+        data = UBX_NAV_PVT_data_t{};
+        data.year = t.tm_year + 1900;
+        data.month = t.tm_mon + 1;
+        data.day = t.tm_mday;
+        data.hour = t.tm_hour;
+        data.min = t.tm_min;
+        data.sec = t.tm_sec;
+        data.valid.bits.validDate = has_fix();
+        data.valid.bits.validTime = has_fix();
+        data.valid.bits.fullyResolved = has_fix();
+        data.fixType = has_fix() ? 3 : 0;
+        data.flags.bits.gnssFixOK = has_fix();
+        data.numSV = has_fix() ? 9 : 0;
+        data.lat = std::lround(sample_.lat * 1e7);
+        data.lon = std::lround(sample_.lng * 1e7);
+        data.hMSL = std::lround(sample_.alt * 1e3);
+        data.height = data.hMSL;
+        data.hAcc = std::lround(sim::world.gnss_noise_m * 1e3);
+        data.vAcc = std::lround(sim::world.gnss_noise_m * 1.5e3);
+
+        // Ground speed and heading from the ride, one second earlier.
+        sim::sample_t now = sim::world.sample_at(sim::world.now_ms);
+        uint64_t before_ms = sim::world.now_ms > 1000 ? sim::world.now_ms - 1000 : 0;
+        sim::sample_t before = sim::world.sample_at(before_ms);
+        double dy = (now.lat - before.lat) * 111320.0;
+        double dx = (now.lng - before.lng) * 111320.0 * std::cos(now.lat * M_PI / 180.0);
+        double heading = std::atan2(dx, dy) * 180.0 / M_PI;
+        data.gSpeed = std::lround(std::sqrt(dx * dx + dy * dy) * 1e3);
+        data.headMot = std::lround((heading < 0 ? heading + 360.0 : heading) * 1e5);
+        data.pDOP = 150;
+
+        return true;
+    }
+
+    void flushPVT()
+    {
+        for (bool &fresh : fresh_) {
+            fresh = false;
+        }
+    }
+
+    // Like the actual library, every getter polls a new NAV-PVT frame if the field it reads has
+    // already been read from the previous frame.
+    bool getGnssFixOk() { return poll(FIX_OK) && has_fix(); }
+    uint8_t getSIV() { return poll(SIV) && has_fix() ? 9 : 0; }
+
+    int32_t getLatitude() { poll(LAT); return std::lround(sample_.lat * 1e7); }
+    int32_t getLongitude() { poll(LNG); return std::lround(sample_.lng * 1e7); }
+    int32_t getAltitudeMSL() { poll(ALT); return std::lround(sample_.alt * 1e3); }
+
+    bool getDateValid() { return poll(DATE_VALID) && has_fix(); }
+    uint16_t getYear() { poll(YEAR); return tm().tm_year + 1900; }
+    uint8_t getMonth() { poll(MONTH); return tm().tm_mon + 1; }
+    uint8_t getDay() { poll(DAY); return tm().tm_mday; }
+
+    bool getTimeValid() { return poll(TIME_VALID) && has_fix(); }
+    uint8_t getHour() { poll(HOUR); return tm().tm_hour; }
+    uint8_t getMinute() { poll(MINUTE); return tm().tm_min; }
+    uint8_t getSecond() { poll(SECOND); return tm().tm_sec; }
+
+private:
+    // The replayed rides start on 2021-01-01 00:00:00 UTC.
+    static constexpr time_t RIDE_START = 1609459200;
+
+    // A NAV-PVT poll request is 8 bytes, the response 100 bytes, at 10 bits per byte. The response
+    // takes about twice as long when the module also outputs NMEA sentences.
+    static constexpr uint32_t PVT_POLL_BITS = (8 + 100) * 10;
+
+    static constexpr uint64_t BEGIN_TIMEOUT_MS = 1100;
+
+    // Saved as a whole, whatever the selected subsections. Only GPS, SBAS, QZSS and GLONASS are
+    // enabled by default.
+    struct config_t {
+        uint32_t baud{9600};
+        bool nmea{true};
+        bool gnss[SFE_UBLOX_GNSS_ID_GLONASS + 1]{true, true, false, false, false, true, true};
+    };
+
+    config_t config_{};
+    config_t saved_config_{};
+
+    enum field_t {
+        FIX_OK, SIV, LAT, LNG, ALT,
+        DATE_VALID, YEAR, MONTH, DAY, TIME_VALID, HOUR, MINUTE, SECOND,
+        N_FIELDS
+    };
+
+    bool power_save_{false};
+
+    bool auto_pvt_{false};
+
+    UBX_NAV_PVT_t pvt_{};
+
+    // Fields of the last NAV-PVT frame that have not been read yet.
+    bool fresh_[N_FIELDS]{};
+
+    sim::sample_t sample_{};
+
+    std::mt19937 rng_{42};
+
+    HardwareSerial *serial_{nullptr};
+
+    // The UBX frame being written by the firmware, from its class byte to its checksum.
+    std::vector<uint8_t> frame_;
+    uint8_t n_sync_{0};
+
+    uint16_t measurement_rate_ms_{1000};
+
+    // Batching state: the time of the next fix to batch, and the size of the batch buffer.
+    bool batching_{false};
+    uint64_t next_batch_ms_{0};
+    uint16_t batch_size_{0};
+
+    // Parses the UBX frames written by the firmware, one byte at a time.
+    void parse(uint8_t c)
+    {
+        if (n_sync_ < 2) {
+            n_sync_ = c == (n_sync_ == 0 ? 0xb5 : 0x62) ? n_sync_ + 1 : 0;
+            return;
+        }
+
+        frame_.push_back(c);
+
+        // Class, ID, length, payload and checksum.
+        if (frame_.size() >= 4 && frame_.size() == 4 + (frame_[2] | frame_[3] << 8) + 2u) {
+            handle(frame_[0], frame_[1], frame_.data() + 4, frame_.size() - 6);
+            frame_.clear();
+            n_sync_ = 0;
+        }
+    }
+
+    void handle(uint8_t cls, uint8_t id, const uint8_t *payload, size_t size)
+    {
+        if (cls == 0x06 && id == 0x93 && size == 8) {
+            // CFG-BATCH
+            batching_ = payload[1] & 0x01;
+            batch_size_ = payload[2] | payload[3] << 8;
+            next_batch_ms_ = sim::world.now_ms + measurement_rate_ms_;
+
+            const uint8_t ack[2] = { cls, id };
+            respond(0x05, 0x01, ack, sizeof(ack));
+        } else if (cls == 0x21 && id == 0x10 && batching_) {
+            // LOG-RETRIEVEBATCH
+            retrieve_batch();
+        }
+    }
+
+    // Sends the fixes computed since the previous retrieval, preceded by a MON-BATCH frame.
+    void retrieve_batch()
+    {
+        std::vector<std::vector<uint8_t>> entries;
+        uint16_t n_dropped = 0;
+
+        for (; next_batch_ms_ <= sim::world.now_ms; next_batch_ms_ += measurement_rate_ms_) {
+            if (next_batch_ms_ < sim::world.gnss_fix_at_ms) {
+                continue;
+            }
+
+            if (entries.size() == batch_size_) {
+                entries.erase(entries.begin());
+                ++n_dropped;
+            }
+
+            entries.push_back(batch_entry(next_batch_ms_));
+        }
+
+        uint8_t status[12] = {};
+        status[4] = entries.size() & 0xff;
+        status[5] = entries.size() >> 8;
+        status[8] = n_dropped & 0xff;
+        status[9] = n_dropped >> 8;
+        respond(0x0a, 0x32, status, sizeof(status));
+
+        for (const std::vector<uint8_t> &entry : entries) {
+            respond(0x21, 0x11, entry.data(), entry.size());
+        }
+    }
+
+    // A LOG-BATCH entry, with the extra PVT fields, for the fix at `time_ms`.
+    std::vector<uint8_t> batch_entry(uint64_t time_ms)
+    {
+        sim::sample_t sample = noisy_sample(time_ms);
+        struct tm t = tm(time_ms);
+
+        std::vector<uint8_t> entry(100, 0);
+        auto put = [&](size_t offset, uint32_t value, size_t n_bytes) {
+            for (size_t i = 0; i < n_bytes; ++i) {
+                entry[offset + i] = value >> (8 * i);
+            }
+        };
+
+        put(8, t.tm_year + 1900, 2);
+        put(10, t.tm_mon + 1, 1);
+        put(11, t.tm_mday, 1);
+        put(12, t.tm_hour, 1);
+        put(13, t.tm_min, 1);
+        put(14, t.tm_sec, 1);
+        put(15, 0x03, 1);   // validDate, validTime
+        put(24, 3, 1);      // fixType
+        put(25, 0x01, 1);   // gnssFixOK
+        put(27, 9, 1);      // numSV
+        put(28, std::lround(sample.lng * 1e7), 4);
+        put(32, std::lround(sample.lat * 1e7), 4);
+        put(40, std::lround(sample.alt * 1e3), 4);
+        put(44, std::lround(sim::world.gnss_noise_m * 1e3), 4);
+        put(80, 150, 2);    // pDOP
+
+        return entry;
+    }
+
+    // Queues a UBX frame for the firmware, accounting its transfer time.
+    void respond(uint8_t cls, uint8_t id, const uint8_t *payload, size_t size)
+    {
+        std::vector<uint8_t> frame = { 0xb5, 0x62, cls, id, (uint8_t) size, (uint8_t) (size >> 8) };
+        frame.insert(frame.end(), payload, payload + size);
+
+        uint8_t ck_a = 0, ck_b = 0;
+        for (size_t i = 2; i < frame.size(); ++i) {
+            ck_a += frame[i];
+            ck_b += ck_a;
+        }
+        frame.push_back(ck_a);
+        frame.push_back(ck_b);
+
+        for (uint8_t c : frame) {
+            serial_->receive(c);
+        }
+
+        sim::world.advance(frame.size() * 10 * 1000 / config_.baud, sim::world.awake_ms);
+    }
+
+    // Polls a new frame if `field` has already been read. Returns false if the receiver is off.
+    bool poll(field_t field)
+    {
+        if (!sim::world.gnss_on) {
+            return false;
+        }
+
+        if (!fresh_[field]) {
+            uint64_t poll_ms = PVT_POLL_BITS * 1000 / config_.baud * (config_.nmea ? 2 : 1);
+            sim::world.advance(poll_ms, sim::world.awake_ms);
+
+            sample();
+
+            for (bool &fresh : fresh_) {
+                fresh = true;
+            }
+        }
+
+        fresh_[field] = false;
+
+        return true;
+    }
+
+    bool has_fix() const
+    {
+        return sim::world.gnss_has_fix();
+    }
+
+    void sample()
+    {
+        sample_ = noisy_sample(sim::world.now_ms);
+    }
+
+    // Samples the ground truth, adding some noise to mimic the receiver's accuracy.
+    sim::sample_t noisy_sample(uint64_t time_ms)
+    {
+        sim::sample_t sample = sim::world.sample_at(time_ms);
+
+        std::normal_distribution<double> noise(0.0, sim::world.gnss_noise_m);
+        sample.lat += noise(rng_) / 111320.0;
+        sample.lng += noise(rng_) / (111320.0 * std::cos(sample.lat * M_PI / 180.0));
+        sample.alt += noise(rng_) * 1.5;
+
+        return sample;
+    }
+
+    struct tm tm(uint64_t time_ms = sim::world.now_ms) const
+    {
+        time_t t = RIDE_START + time_ms / 1000;
+        struct tm result;
+        gmtime_r(&t, &result);
+        return result;
+    }
+};
@@ -0,0 +1,74 @@
+#pragma once
+
+// Simulated I2C bus, with a LIS3DH accelerometer reporting the movements of the replayed ride.
+
+#include "Arduino.h"
+
+class TwoWire {
+public:
+    void begin() { }
+
+    void beginTransmission(uint8_t address)
+    {
+        address_ = address;
+        n_written_ = 0;
+    }
+
+    size_t write(uint8_t value)
+    {
+        if (n_written_ == 0) {
+            register_ = value;
+        } else {
+            registers_[register_] = value;
+        }
+        ++n_written_;
+        return 1;
+    }
+
+    // Returns 2 (address NACK) if there is no accelerometer.
+    uint8_t endTransmission(bool = true)
+    {
+        return answers() ? 0 : 2;
+    }
+
+    uint8_t requestFrom(uint8_t address, uint8_t n)
+    {
+        address_ = address;
+        return answers() ? n : 0;
+    }
+
+    int read()
+    {
+        switch (register_) {
+        case WHO_AM_I:
+            return 0x33;
+        case INT1_SRC: {
+            // Reading the interrupt source clears the latched movement.
+            bool motion = sim::world.accelerometer_motion;
+            sim::world.accelerometer_motion = false;
+            return motion ? 0x40 : 0x00;
+        }
+        default:
+            return registers_[register_];
+        }
+    }
+
+private:
+    static constexpr uint8_t ADDRESS = 0x18;
+
+    static constexpr uint8_t WHO_AM_I = 0x0f;
+    static constexpr uint8_t INT1_SRC = 0x31;
+
+    uint8_t address_{0};
+    uint8_t register_{0};
+    size_t n_written_{0};
+
+    uint8_t registers_[256]{};
+
+    bool answers() const
+    {
+        return sim::world.has_accelerometer && address_ == ADDRESS;
+    }
+};
+
+inline TwoWire Wire;
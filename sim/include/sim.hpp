@@ -0,0 +1,284 @@
+#pragma once
+
+// State of the simulated world the tracker runs in: a virtual clock, the replayed ride and the
+// counters used to report energy and airtime.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace sim {
+
+// Pin of `bike_tracker::button_t::a`.
+constexpr int BUTTON_PIN = 2;
+
+// A ground truth sample of the replayed ride.
+struct sample_t {
+    uint32_t time; // secs since the start of the ride
+    double lat;    // degrees
+    double lng;    // degrees
+    double alt;    // meters
+};
+
+struct uplink_t {
+    uint64_t time_ms;
+    std::vector<uint8_t> payload;
+    bool downlink;
+    bool delivered;
+};
+
+// Callback response answered to the first uplink requesting a downlink at or after `time` (in
+// seconds since the start of the ride).
+struct downlink_t {
+    uint32_t time;
+    uint8_t data[8];
+};
+
+// Time range (in seconds since the start of the ride) without any SigFox coverage.
+struct outage_t {
+    uint32_t begin;
+    uint32_t end;
+};
+
+// Resets the board after `time` seconds of ride, keeping the RTC running unless the power is lost
+// too (e.g. a battery swap). The flash is kept in both cases.
+struct reset_t {
+    uint32_t time;
+    bool power_loss;
+};
+
+struct world_t {
+    bool verbose{false};
+
+    uint64_t now_ms{0};
+
+    std::vector<sample_t> ride;
+    std::vector<outage_t> outages;
+    std::vector<downlink_t> downlinks;
+    std::vector<reset_t> resets;
+
+    // Periods during which the GPS module does not answer when powered up (e.g. a latched-up
+    // module, or a loose connector).
+    std::vector<outage_t> gnss_unresponsive;
+
+    // Interrupt handler attached by the movement detector, if any, and set when it or the button
+    // interrupt has been triggered.
+    void (*interrupt)(){nullptr};
+    bool interrupted{false};
+
+    // Interrupt handler attached on `BUTTON_PIN`, if any, and the times at which the button is
+    // pressed (in secs of ride).
+    void (*button_interrupt)(){nullptr};
+    std::vector<uint32_t> button_presses;
+
+    // Whether the tracker has an accelerometer, and if it detected a movement since it has last
+    // been polled.
+    bool has_accelerometer{true};
+    bool accelerometer_motion{false};
+
+    // Accumulated time spent in each power state, in milliseconds.
+    uint64_t awake_ms{0};
+    uint64_t sleep_ms{0};
+    uint64_t gnss_on_ms{0};
+    uint64_t radio_tx_ms{0};
+    uint64_t radio_rx_ms{0};
+
+    uint32_t n_wake_ups{0};
+
+    // The longest time the MCU stayed awake between two sleeps, and the start of the current one.
+    uint64_t max_awake_period_ms{0};
+    uint64_t awake_since_ms{0};
+
+    // The simulated receiver reports a fix `gnss_hot_ttff_ms` after being powered on if it still
+    // has a valid ephemeris, i.e. if it had a fix less than `GNSS_EPHEMERIS_VALIDITY_MS` before
+    // being powered off, and `gnss_cold_ttff_ms` otherwise.
+    static constexpr uint64_t GNSS_EPHEMERIS_VALIDITY_MS = 4 * 3600 * 1000;
+
+    bool gnss_on{false};
+    uint64_t gnss_fix_at_ms{0};
+    uint64_t gnss_ephemeris_until_ms{0};
+    uint64_t gnss_hot_ttff_ms{2 * 1000};
+    uint64_t gnss_cold_ttff_ms{30 * 1000};
+
+    // Time at which the receiver leaves its timed backup mode, 0 if none.
+    uint64_t gnss_wake_up_at_ms{0};
+
+    uint32_t n_gnss_hot_starts{0};
+    uint32_t n_gnss_cold_starts{0};
+
+    // The RTC runs `rtc_drift_ppm` faster than the simulated clock. Its alarm, if enabled, is in
+    // RTC milliseconds.
+    double rtc_drift_ppm{0};
+    int64_t rtc_offset_ms{0};
+    bool rtc_alarm_enabled{false};
+    int64_t rtc_alarm_ms{0};
+
+    // Voltage of the batteries, constant during the ride.
+    double battery_voltage{3.0};
+
+    // Standard deviation of the simulated GNSS position error.
+    double gnss_noise_m{3.0};
+
+    // Whether the simulated receiver runs a firmware supporting the batching of its fixes (u-blox
+    // M8 protocol 23.01 or later).
+    bool gnss_batching{false};
+
+    std::vector<uplink_t> uplinks;
+
+    uint32_t duration() const
+    {
+        return ride.empty() ? 0 : ride.back().time;
+    }
+
+    bool finished() const
+    {
+        return now_ms / 1000 > duration();
+    }
+
+    // Interpolates the ground truth position at the given time.
+    sample_t sample_at(uint64_t time_ms) const
+    {
+        double time = time_ms / 1000.0;
+
+        if (ride.empty()) {
+            return sample_t{0, 0, 0, 0};
+        } else if (time <= ride.front().time) {
+            return ride.front();
+        } else if (time >= ride.back().time) {
+            return ride.back();
+        }
+
+        size_t hi = 1;
+        while (ride[hi].time < time) {
+            ++hi;
+        }
+
+        const sample_t &a = ride[hi - 1];
+        const sample_t &b = ride[hi];
+        double r = (time - a.time) / (b.time - a.time);
+
+        return sample_t{
+            (uint32_t) time,
+            a.lat + (b.lat - a.lat) * r,
+            a.lng + (b.lng - a.lng) * r,
+            a.alt + (b.alt - a.alt) * r,
+        };
+    }
+
+    void gnss_power_on(uint64_t at_ms)
+    {
+        bool hot = at_ms < gnss_ephemeris_until_ms;
+
+        gnss_on = true;
+        gnss_fix_at_ms = at_ms + (hot ? gnss_hot_ttff_ms : gnss_cold_ttff_ms);
+        gnss_wake_up_at_ms = 0;
+
+        ++(hot ? n_gnss_hot_starts : n_gnss_cold_starts);
+    }
+
+    // Restarts the receiver without any satellite data, e.g. after a GNSS configuration change.
+    void gnss_cold_restart()
+    {
+        gnss_ephemeris_until_ms = 0;
+        gnss_fix_at_ms = now_ms + gnss_cold_ttff_ms;
+    }
+
+    void gnss_power_off(uint64_t wake_up_in_ms)
+    {
+        if (gnss_on && now_ms >= gnss_fix_at_ms) {
+            gnss_ephemeris_until_ms = now_ms + GNSS_EPHEMERIS_VALIDITY_MS;
+        }
+
+        gnss_on = false;
+        gnss_wake_up_at_ms = wake_up_in_ms > 0 ? now_ms + wake_up_in_ms : 0;
+    }
+
+    bool gnss_has_fix() const
+    {
+        return gnss_on && now_ms >= gnss_fix_at_ms;
+    }
+
+    int64_t rtc_ms() const
+    {
+        return now_ms + (int64_t) (now_ms * rtc_drift_ppm / 1e6) + rtc_offset_ms;
+    }
+
+    // Simulated milliseconds until the RTC alarm, 0 if it already fired.
+    uint64_t until_rtc_alarm() const
+    {
+        int64_t rtc_delay = rtc_alarm_ms - rtc_ms();
+
+        return rtc_delay > 0 ? (uint64_t) std::ceil(rtc_delay / (1 + rtc_drift_ppm / 1e6)) : 0;
+    }
+
+    bool has_coverage() const
+    {
+        return !during(outages);
+    }
+
+    bool gnss_is_unresponsive() const
+    {
+        return during(gnss_unresponsive);
+    }
+
+    // True if the current time is within one of the periods.
+    bool during(const std::vector<outage_t> &periods) const
+    {
+        uint32_t time = now_ms / 1000;
+        for (const outage_t &period : periods) {
+            if (time >= period.begin && time < period.end) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Moves the clock forward, accounting the elapsed time in `counter`.
+    //
+    // Triggers the attached interrupt if the bike moved in the meantime.
+    void advance(uint64_t ms, uint64_t &counter)
+    {
+        sample_t before = sample_at(now_ms);
+        uint64_t before_ms = now_ms;
+
+        now_ms += ms;
+        counter += ms;
+
+        if (&counter == &sleep_ms) {
+            awake_since_ms = now_ms;
+        } else {
+            max_awake_period_ms = std::max(max_awake_period_ms, now_ms - awake_since_ms);
+        }
+
+        if (gnss_on) {
+            gnss_on_ms += ms;
+        } else if (gnss_wake_up_at_ms != 0 && now_ms >= gnss_wake_up_at_ms) {
+            gnss_on_ms += now_ms - gnss_wake_up_at_ms;
+            gnss_power_on(gnss_wake_up_at_ms);
+        }
+
+        for (uint32_t press : button_presses) {
+            uint64_t press_ms = press * 1000ull;
+
+            if (button_interrupt != nullptr && press_ms > before_ms && press_ms <= now_ms) {
+                button_interrupt();
+                interrupted = true;
+            }
+        }
+
+        sample_t after = sample_at(now_ms);
+        if (before.lat != after.lat || before.lng != after.lng) {
+            accelerometer_motion = true;
+
+            if (interrupt != nullptr) {
+                interrupt();
+                interrupted = true;
+            }
+        }
+    }
+};
+
+inline world_t world;
+
+} // namespace sim
@@ -0,0 +1,416 @@
+// Replays a recorded ride through `bike_tracker_t::loop()` on the host, using the simulated
+// hardware from `include/`, and reports the energy, airtime and accuracy of the run.
+//
+// Usage: bike_tracker_sim [-v] [--no-accelerometer] [--gnss-batching] [--rtc-drift <ppm>]
+//                         [--ttff <secs>] [--battery <volts>] [--outage <from>-<to>]...
+//                         [--downlink <at>:<hex>]... [--reset <at>]... [--power-loss <at>]...
+//                         [--gnss-unresponsive <from>-<to>]... [--button <at>]...
+//                         <ride.csv|ride.nmea>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <sstream>
+#include <string>
+
+#include <Arduino.h>
+
+#include "../bike_tracker.hpp"
+
+namespace {
+
+// Parses a `time,lat,lng,alt` CSV line (time in secs since the start of the ride).
+bool parse_csv(const std::string &line, sim::sample_t *sample)
+{
+    return sscanf(
+        line.c_str(), "%u,%lf,%lf,%lf",
+        &sample->time, &sample->lat, &sample->lng, &sample->alt) == 4;
+}
+
+// Converts a NMEA `ddmm.mmmm` field to degrees.
+double nmea_degrees(const std::string &value, const std::string &hemisphere)
+{
+    double raw = atof(value.c_str());
+    double degrees = floor(raw / 100) + fmod(raw, 100) / 60;
+    return hemisphere == "S" || hemisphere == "W" ? -degrees : degrees;
+}
+
+// Parses a `$..GGA` sentence, ignoring the sentences without a fix.
+bool parse_nmea(const std::string &line, sim::sample_t *sample, uint32_t *first_time)
+{
+    if (line.size() < 6 || line[0] != '$' || line.compare(3, 3, "GGA") != 0) {
+        return false;
+    }
+
+    std::vector<std::string> fields;
+    std::stringstream ss(line);
+    for (std::string field; std::getline(ss, field, ',');) {
+        fields.push_back(field);
+    }
+
+    if (fields.size() < 10 || fields[6] == "0" || fields[2].empty()) {
+        return false;
+    }
+
+    uint32_t hhmmss = atoi(fields[1].c_str());
+    uint32_t time = (hhmmss / 10000) * 3600 + (hhmmss / 100 % 100) * 60 + hhmmss % 100;
+
+    if (*first_time == UINT32_MAX) {
+        *first_time = time;
+    }
+
+    sample->time = time - *first_time;
+    sample->lat = nmea_degrees(fields[2], fields[3]);
+    sample->lng = nmea_degrees(fields[4], fields[5]);
+    sample->alt = atof(fields[9].c_str());
+
+    return true;
+}
+
+bool load_ride(const char *path)
+{
+    std::ifstream file(path);
+    if (!file) {
+        return false;
+    }
+
+    uint32_t first_time = UINT32_MAX;
+
+    for (std::string line; std::getline(file, line);) {
+        sim::sample_t sample;
+        if (parse_csv(line, &sample) || parse_nmea(line, &sample, &first_time)) {
+            sim::world.ride.push_back(sample);
+        }
+    }
+
+    return !sim::world.ride.empty();
+}
+
+double mah(uint64_t ms, double ma)
+{
+    return ma * ms / 3600.0 / 1000.0;
+}
+
+using tracker_t = bike_tracker::bike_tracker_t<bike_tracker::SIM_PROFILE>;
+using bike_tracker::radio_t;
+
+struct point_t {
+    double lat;
+    double lng;
+};
+
+uint32_t read_bits(const uint8_t *data, size_t *offset, uint8_t n_bits)
+{
+    uint32_t value = 0;
+    for (uint8_t i = 0; i < n_bits; ++i, ++*offset) {
+        value = (value << 1) | ((data[*offset / 8] >> (7 - *offset % 8)) & 1);
+    }
+    return value;
+}
+
+// Decodes a `radio_t::packed_track_t`, see its documentation for the layout.
+std::vector<point_t> decode_track(const uint8_t *data, size_t size)
+{
+    std::vector<point_t> points;
+
+    if (std::all_of(data, data + size, [](uint8_t b) { return b == 0; })) {
+        return points;
+    }
+
+    size_t offset = 0;
+    int32_t lat = read_bits(data, &offset, 24);
+    int32_t lng = read_bits(data, &offset, 24);
+    uint32_t n_deltas = read_bits(data, &offset, 3);
+    uint32_t scale = read_bits(data, &offset, 3);
+    read_bits(data, &offset, 2);
+
+    for (uint32_t i = 0; i <= n_deltas; ++i) {
+        if (i > 0) {
+            int32_t d_lat = read_bits(data, &offset, 4);
+            int32_t d_lng = read_bits(data, &offset, 4);
+            lat += (d_lat >= 8 ? d_lat - 16 : d_lat) * (1 << scale);
+            lng += (d_lng >= 8 ? d_lng - 16 : d_lng) * (1 << scale);
+        }
+
+        points.push_back(point_t{lat * 180.0 / (1 << 24) - 90, lng * 360.0 / (1 << 24) - 180});
+    }
+
+    return points;
+}
+
+// Prints the `radio_t::trip_msg_t` trip summaries, see its documentation for the layout.
+void report_trips()
+{
+    for (const sim::uplink_t &uplink : sim::world.uplinks) {
+        if (!uplink.delivered || uplink.payload.size() != sizeof(radio_t::trip_msg_t)) {
+            continue;
+        }
+
+        size_t offset = 0;
+        uint32_t id = read_bits(uplink.payload.data(), &offset, 8);
+        uint32_t age = read_bits(uplink.payload.data(), &offset, 6) * 60;
+        uint32_t duration = read_bits(uplink.payload.data(), &offset, 14) * 16;
+        uint32_t moving_time = read_bits(uplink.payload.data(), &offset, 14) * 16;
+        uint32_t distance = read_bits(uplink.payload.data(), &offset, 15) * 20;
+        uint32_t alt_gain = read_bits(uplink.payload.data(), &offset, 9) * 8;
+        double max_speed = read_bits(uplink.payload.data(), &offset, 6) / 2.0;
+
+        printf(
+            "Trip %u:         %u s long, ended %u s before %llu s - %.2f km in %u s, "
+            "%u m gain, %.1f m/s max\n",
+            id, duration, age, (unsigned long long) (uplink.time_ms / 1000), distance / 1000.0,
+            moving_time, alt_gain, max_speed);
+    }
+}
+
+// Decodes the locations sent by the tracker. Backlog messages are recognized by their size.
+std::vector<point_t> decode(const sim::uplink_t &uplink)
+{
+    const uint8_t *data = uplink.payload.data();
+    size_t size = uplink.payload.size();
+
+    if (size == sizeof(radio_t::backlog_msg_t)) {
+        return decode_track(data + 2, size - 2);
+    } else if (size != sizeof(tracker_t::location_msg_t)) {
+        // Telemetry, trip and heartbeat messages.
+        return {};
+    } else if constexpr (std::is_same_v<tracker_t::location_msg_t, radio_t::track_msg_t>) {
+        return decode_track(data, size);
+    } else {
+        // See `radio_t::location_msg_t` for the layout.
+        size_t offset = 3;
+        uint32_t lat = read_bits(data, &offset, 24);
+        uint32_t lng = read_bits(data, &offset, 24);
+
+        if (lat == 0 && lng == 0) {
+            return {};
+        } else {
+            return {point_t{lat * 180.0 / (1 << 24) - 90, lng * 360.0 / (1 << 24) - 180}};
+        }
+    }
+}
+
+// Returns the distance from the point to the closest position of the ride.
+double ride_error(const point_t &point)
+{
+    double error = INFINITY;
+
+    for (size_t i = 0; i < sim::world.ride.size(); ++i) {
+        const sim::sample_t &sample = sim::world.ride[i];
+
+        double dy = (point.lat - sample.lat) * 111320;
+        double dx = (point.lng - sample.lng) * 111320 * cos(sample.lat * M_PI / 180);
+
+        error = std::min(error, sqrt(dx * dx + dy * dy));
+    }
+
+    return error;
+}
+
+void report()
+{
+    const sim::world_t &w = sim::world;
+
+    uint32_t n_delivered = 0, n_downlinks = 0;
+    uint64_t payload_bytes = 0;
+    for (const sim::uplink_t &uplink : w.uplinks) {
+        n_delivered += uplink.delivered;
+        n_downlinks += uplink.downlink;
+        payload_bytes += uplink.payload.size();
+    }
+
+    printf("Ride duration:  %u s (%zu samples)\n", w.duration(), w.ride.size());
+    printf("Wake-ups:       %u\n", w.n_wake_ups);
+    // The MCU is also awake while waiting for the radio.
+    uint64_t awake_ms = w.now_ms - w.sleep_ms;
+
+    printf("Awake:          %llu ms\n", (unsigned long long) awake_ms);
+    printf("Longest awake:  %llu ms\n", (unsigned long long) w.max_awake_period_ms);
+    printf("Sleep:          %llu ms\n", (unsigned long long) w.sleep_ms);
+    printf("GNSS on:        %llu ms\n", (unsigned long long) w.gnss_on_ms);
+    printf(
+        "GNSS starts:    %u hot, %u cold\n", w.n_gnss_hot_starts, w.n_gnss_cold_starts);
+    printf("Radio TX:       %llu ms\n", (unsigned long long) w.radio_tx_ms);
+    printf("Radio RX:       %llu ms\n", (unsigned long long) w.radio_rx_ms);
+    printf(
+        "Uplinks:        %zu (%u delivered, %u downlink requests, %llu payload bytes)\n",
+        w.uplinks.size(), n_delivered, n_downlinks, (unsigned long long) payload_bytes);
+
+    // Uses the same current figures as the firmware's own accounting.
+    using bike_tracker::energy::CURRENT;
+    using bike_tracker::energy::subsystem_t;
+    auto current = [](subsystem_t subsystem) { return CURRENT[static_cast<size_t>(subsystem)]; };
+
+    double total =
+        mah(awake_ms, current(subsystem_t::MCU_AWAKE)) +
+        mah(w.sleep_ms, current(subsystem_t::MCU_SLEEP)) +
+        mah(w.gnss_on_ms, current(subsystem_t::GPS)) +
+        mah(w.radio_tx_ms, current(subsystem_t::RADIO_TX)) +
+        mah(w.radio_rx_ms, current(subsystem_t::RADIO_RX));
+    printf("Estimated:      %.3f mAh (firmware estimate: %.3f mAh)\n", total,
+        bike_tracker::energy::total_charge());
+
+    // Compares the delivered locations with the ride.
+    double error_sum = 0;
+    uint32_t n_points = 0;
+    for (const sim::uplink_t &uplink : w.uplinks) {
+        if (uplink.delivered) {
+            for (const point_t &point : decode(uplink)) {
+                error_sum += ride_error(point);
+                ++n_points;
+            }
+        }
+    }
+
+    printf("Track points:   %u\n", n_points);
+    if (n_points > 0) {
+        printf("Position error: %.1f m (mean distance to the ride)\n", error_sum / n_points);
+    }
+
+    report_trips();
+}
+
+// Writes to the standard output, e.g. the `benchmark::print()` table.
+class stdout_t : public Print {
+public:
+    size_t write(uint8_t c) override
+    {
+        return fputc(c, stdout) == EOF ? 0 : 1;
+    }
+
+    using Print::write;
+};
+
+} // namespace
+
+tracker_t tracker;
+
+// Restarts the firmware from `setup()`, like the board after a reset. The flash and, unless the
+// power is lost, the RTC and the GPS backup RAM are kept.
+void reset(const sim::reset_t &reset)
+{
+    fprintf(
+        stderr, "%s after %u s\n", reset.power_loss ? "Power loss" : "Reset", reset.time);
+
+    if (reset.power_loss) {
+        sim::world.rtc_offset_ms -= sim::world.rtc_ms();
+        sim::world.gnss_ephemeris_until_ms = 0;
+    }
+
+    sim::world.interrupt = nullptr;
+    sim::world.rtc_alarm_enabled = false;
+
+    tracker.~tracker_t();
+    new (&tracker) tracker_t();
+    tracker.setup();
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = nullptr;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-v") == 0) {
+            sim::world.verbose = true;
+        } else if (strcmp(argv[i], "--no-accelerometer") == 0) {
+            sim::world.has_accelerometer = false;
+        } else if (strcmp(argv[i], "--gnss-batching") == 0) {
+            sim::world.gnss_batching = true;
+        } else if (strcmp(argv[i], "--rtc-drift") == 0 && i + 1 < argc) {
+            sim::world.rtc_drift_ppm = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--battery") == 0 && i + 1 < argc) {
+            sim::world.battery_voltage = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--ttff") == 0 && i + 1 < argc) {
+            sim::world.gnss_cold_ttff_ms = atoi(argv[++i]) * 1000ull;
+        } else if (strcmp(argv[i], "--downlink") == 0 && i + 1 < argc) {
+            sim::downlink_t downlink;
+            unsigned long long data;
+            if (sscanf(argv[++i], "%u:%llx", &downlink.time, &data) != 2) {
+                fprintf(stderr, "Invalid downlink: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+            for (size_t j = 0; j < sizeof(downlink.data); ++j) {
+                downlink.data[j] = data >> (8 * (sizeof(downlink.data) - 1 - j));
+            }
+            sim::world.downlinks.push_back(downlink);
+        } else if (strcmp(argv[i], "--outage") == 0 && i + 1 < argc) {
+            sim::outage_t outage;
+            if (sscanf(argv[++i], "%u-%u", &outage.begin, &outage.end) != 2) {
+                fprintf(stderr, "Invalid outage: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+            sim::world.outages.push_back(outage);
+        } else if (strcmp(argv[i], "--gnss-unresponsive") == 0 && i + 1 < argc) {
+            sim::outage_t period;
+            if (sscanf(argv[++i], "%u-%u", &period.begin, &period.end) != 2) {
+                fprintf(stderr, "Invalid GNSS period: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+            sim::world.gnss_unresponsive.push_back(period);
+        } else if (strcmp(argv[i], "--button") == 0 && i + 1 < argc) {
+            sim::world.button_presses.push_back(atoi(argv[++i]));
+        } else if (
+            (strcmp(argv[i], "--reset") == 0 || strcmp(argv[i], "--power-loss") == 0) &&
+            i + 1 < argc
+        ) {
+            bool power_loss = strcmp(argv[i], "--power-loss") == 0;
+            sim::world.resets.push_back(sim::reset_t{(uint32_t) atoi(argv[++i]), power_loss});
+        } else {
+            path = argv[i];
+        }
+    }
+
+    if (path == nullptr) {
+        fprintf(
+            stderr,
+            "Usage: %s [-v] [--no-accelerometer] [--gnss-batching] [--rtc-drift <ppm>] "
+            "[--ttff <secs>] [--battery <volts>] "
+            "[--outage <from>-<to>]... [--downlink <at>:<hex>]... [--reset <at>]... "
+            "[--power-loss <at>]... [--gnss-unresponsive <from>-<to>]... [--button <at>]... "
+            "<ride.csv|ride.nmea>\n",
+            argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (!load_ride(path)) {
+        fprintf(stderr, "Unable to load ride: %s\n", path);
+        return EXIT_FAILURE;
+    }
+
+    std::sort(
+        sim::world.resets.begin(), sim::world.resets.end(),
+        [](const sim::reset_t &a, const sim::reset_t &b) { return a.time < b.time; });
+    size_t next_reset = 0;
+
+    tracker.setup();
+
+    while (!sim::world.finished()) {
+        if (
+            next_reset < sim::world.resets.size() &&
+            sim::world.now_ms >= sim::world.resets[next_reset].time * 1000ull
+        ) {
+            reset(sim::world.resets[next_reset++]);
+        }
+
+        uint64_t before = sim::world.now_ms;
+
+        tracker.loop();
+
+        // Every iteration is at least 1 ms awake.
+        if (sim::world.now_ms == before) {
+            sim::world.advance(1, sim::world.awake_ms);
+        }
+    }
+
+    report();
+
+    if constexpr (bike_tracker::benchmark::ENABLED) {
+        stdout_t out;
+        bike_tracker::benchmark::print(out);
+    }
+
+    return EXIT_SUCCESS;
+}
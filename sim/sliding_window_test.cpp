@@ -0,0 +1,85 @@
+// Checks `sliding_window_t` against a plain array of the last samples: the count once the ring
+// wrapped around (including across its 32 bits words), `clear()`, and the latest sample.
+//
+// Usage: sliding_window_test
+
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+
+#include <Arduino.h>
+
+#include "../sliding_window.hpp"
+
+namespace {
+
+using bike_tracker::sliding_window_t;
+
+size_t n_failures = 0;
+
+void check(bool condition, const char *what, size_t n_pushed)
+{
+    if (!condition) {
+        fprintf(stderr, "FAILED: %s after %zu samples\n", what, n_pushed);
+        ++n_failures;
+    }
+}
+
+// Pushes pseudo-random samples, comparing the window with the last `n_samples` ones.
+template<size_t n_samples>
+void check_window()
+{
+    sliding_window_t<n_samples> window;
+    std::deque<bool> expected;
+
+    check(window.size() == 0 && window.count() == 0, "empty window", 0);
+
+    uint32_t seed = 12345;
+    for (size_t n_pushed = 1; n_pushed <= 5 * n_samples; ++n_pushed) {
+        seed = seed * 1103515245 + 12345;
+        bool value = (seed >> 16) & 1;
+
+        window.push(value);
+        expected.push_back(value);
+        if (expected.size() > n_samples) {
+            expected.pop_front();
+        }
+
+        size_t expected_count = 0;
+        for (bool sample : expected) {
+            expected_count += sample;
+        }
+
+        check(window.count() == expected_count, "count()", n_pushed);
+        check(window.size() == expected.size(), "size()", n_pushed);
+        check(window.full() == (expected.size() == n_samples), "full()", n_pushed);
+        check(window.latest() == value, "latest()", n_pushed);
+
+        // Clears the window once it wrapped around, and fills it again.
+        if (n_pushed == 2 * n_samples + 1) {
+            window.clear();
+            expected.clear();
+
+            check(window.size() == 0 && window.count() == 0, "clear()", n_pushed);
+        }
+    }
+}
+
+}
+
+int main()
+{
+    check_window<1>();
+    check_window<12>();
+    check_window<32>();
+    check_window<33>();
+    check_window<64>();
+
+    if (n_failures > 0) {
+        fprintf(stderr, "%zu check(s) failed\n", n_failures);
+        return EXIT_FAILURE;
+    }
+
+    printf("sliding_window_t: OK\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace bike_tracker {
+
+// Keeps the last `n_samples` boolean samples, and counts the true ones.
+//
+// The samples are stored as a ring of bits, counted with popcount. The bits of the slots that have
+// not been written yet, or since the last `clear()`, are kept at zero.
+template<size_t n_samples>
+class sliding_window_t {
+public:
+    static_assert(n_samples > 0, "the window should hold at least one sample");
+
+    // Adds a sample, dropping the oldest one if the window is full.
+    void push(bool value)
+    {
+        uint32_t mask = (uint32_t) 1 << (head_ % WORD_BITS);
+        uint32_t &word = words_[head_ / WORD_BITS];
+
+        word = value ? word | mask : word & ~mask;
+
+        head_ = head_ + 1 < n_samples ? head_ + 1 : 0;
+        if (size_ < n_samples) {
+            ++size_;
+        }
+    }
+
+    void clear()
+    {
+        for (uint32_t &word : words_) {
+            word = 0;
+        }
+
+        head_ = 0;
+        size_ = 0;
+    }
+
+    // The number of true samples in the window.
+    size_t count() const
+    {
+        size_t count = 0;
+        for (uint32_t word : words_) {
+            count += __builtin_popcount(word);
+        }
+        return count;
+    }
+
+    // The number of samples in the window.
+    size_t size() const
+    {
+        return size_;
+    }
+
+    bool full() const
+    {
+        return size_ == n_samples;
+    }
+
+    // The index of the slot written by the next `push()`, with the oldest sample if the window is
+    // full.
+    size_t head() const
+    {
+        return head_;
+    }
+
+    // The most recent sample. Undefined if the window is empty.
+    bool latest() const
+    {
+        return test(head_ > 0 ? head_ - 1 : n_samples - 1);
+    }
+
+    // The sample stored in the slot at `index` (see `head()`).
+    bool test(size_t index) const
+    {
+        return (words_[index / WORD_BITS] >> (index % WORD_BITS)) & 1;
+    }
+
+private:
+    static constexpr size_t WORD_BITS = 32;
+
+    uint32_t words_[(n_samples + WORD_BITS - 1) / WORD_BITS]{};
+
+    size_t head_{0};
+    size_t size_{0};
+};
+
+}
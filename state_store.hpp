@@ -0,0 +1,157 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#include <Arduino.h>
+#include <FlashStorage.h>
+
+#include "logger.hpp"
+
+namespace bike_tracker {
+
+// Keeps the latest snapshot of a trivially copyable state in the SAMD21 flash, across resets and
+// battery swaps.
+//
+// Every write erases a flash row, which only supports about 10,000 erase cycles. The snapshots are
+// thus written to `N_SLOTS` rows in turn, each tagged with an increasing sequence number, about
+// multiplying the flash lifetime by `N_SLOTS`. A checksum protects them from writes interrupted by
+// a reset or a brown-out: the previous snapshot is restored instead.
+class state_store_t {
+public:
+    static constexpr size_t N_SLOTS = 8;
+
+    // A flash row, less the header.
+    static constexpr size_t MAX_SIZE = 256 - 16;
+
+    // Layout of a slot in flash.
+    struct record_t {
+        uint32_t magic;
+        uint32_t seq;
+        uint32_t size;
+        uint32_t checksum;
+        uint8_t data[MAX_SIZE];
+    };
+
+    static_assert(sizeof(record_t) == 256);
+
+    // Writes the snapshot to the slot following the latest one. `state_t::VERSION` should change
+    // with the layout of `state_t`, so that older snapshots are not restored.
+    template<typename state_t>
+    void save(const state_t &state);
+
+    // Restores the most recent valid snapshot of the same version and size, if any. Returns false
+    // if there is none.
+    template<typename state_t>
+    bool restore(state_t *state);
+
+private:
+    // The version of the snapshot is in the lowest byte.
+    static constexpr uint32_t MAGIC = 0xb1c55700;
+
+    // The slot written by the next `save()`, and its sequence number.
+    size_t next_slot_{0};
+    uint32_t next_seq_{0};
+
+    // FNV-1a hash of the header and data.
+    static uint32_t checksum(const record_t &record)
+    {
+        uint32_t hash = 2166136261UL;
+
+        auto update = [&hash](const uint8_t *bytes, size_t size) {
+            for (size_t i = 0; i < size; ++i) {
+                hash = (hash ^ bytes[i]) * 16777619UL;
+            }
+        };
+
+        update(reinterpret_cast<const uint8_t *>(&record.magic), sizeof(record.magic));
+        update(reinterpret_cast<const uint8_t *>(&record.seq), sizeof(record.seq));
+        update(reinterpret_cast<const uint8_t *>(&record.size), sizeof(record.size));
+        update(record.data, min(record.size, (uint32_t) MAX_SIZE));
+
+        return hash;
+    }
+
+    // Returns the most recent slot holding a valid snapshot, or `N_SLOTS` if none.
+    size_t latest_slot(uint32_t magic, uint32_t size, record_t *record);
+};
+
+FlashStorage(state_slot_0, state_store_t::record_t);
+FlashStorage(state_slot_1, state_store_t::record_t);
+FlashStorage(state_slot_2, state_store_t::record_t);
+FlashStorage(state_slot_3, state_store_t::record_t);
+FlashStorage(state_slot_4, state_store_t::record_t);
+FlashStorage(state_slot_5, state_store_t::record_t);
+FlashStorage(state_slot_6, state_store_t::record_t);
+FlashStorage(state_slot_7, state_store_t::record_t);
+
+FlashStorageClass<state_store_t::record_t> *const state_slots[state_store_t::N_SLOTS] = {
+    &state_slot_0, &state_slot_1, &state_slot_2, &state_slot_3,
+    &state_slot_4, &state_slot_5, &state_slot_6, &state_slot_7,
+};
+
+template<typename state_t>
+void state_store_t::save(const state_t &state)
+{
+    static_assert(sizeof(state_t) <= MAX_SIZE, "the state should fit in a flash row");
+
+    record_t record{};
+
+    record.magic = MAGIC | state_t::VERSION;
+    record.seq = next_seq_;
+    record.size = sizeof(state_t);
+    memcpy(record.data, &state, sizeof(state_t));
+    record.checksum = checksum(record);
+
+    logger::info("Saving state to flash slot ", next_slot_);
+
+    state_slots[next_slot_]->write(record);
+
+    next_slot_ = (next_slot_ + 1) % N_SLOTS;
+    ++next_seq_;
+}
+
+template<typename state_t>
+bool state_store_t::restore(state_t *state)
+{
+    record_t record;
+    size_t slot = latest_slot(MAGIC | state_t::VERSION, sizeof(state_t), &record);
+
+    if (slot == N_SLOTS) {
+        return false;
+    }
+
+    logger::info("Restoring state from flash slot ", slot);
+
+    memcpy(state, record.data, sizeof(state_t));
+    return true;
+}
+
+size_t state_store_t::latest_slot(uint32_t magic, uint32_t size, record_t *latest)
+{
+    size_t latest_slot = N_SLOTS;
+
+    for (size_t slot = 0; slot < N_SLOTS; ++slot) {
+        record_t record;
+        state_slots[slot]->read(&record);
+
+        bool valid =
+            record.magic == magic && record.size == size && record.checksum == checksum(record);
+
+        // Compares the sequence numbers through their difference, so that they can wrap around.
+        if (valid && (latest_slot == N_SLOTS || (int32_t) (record.seq - latest->seq) > 0)) {
+            latest_slot = slot;
+            *latest = record;
+        }
+    }
+
+    // Writes after the latest snapshot, so that the slots keep being used in turn.
+    if (latest_slot != N_SLOTS) {
+        next_slot_ = (latest_slot + 1) % N_SLOTS;
+        next_seq_ = latest->seq + 1;
+    }
+
+    return latest_slot;
+}
+
+}
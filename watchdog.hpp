@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstdint>
+
+#include <Arduino.h>
+
+// Resets the board when a task takes longer than its timeout, e.g. when a peripheral hangs, so
+// that a stuck MCU does not drain the battery while awake.
+//
+// The SAMD21 watchdog resets the board after at most 16 seconds. Longer timeouts (e.g. while the
+// modem listens for a downlink) are implemented by its early warning interrupt, every 8 seconds,
+// which feeds it again until the timeout expires. The board is thus reset between 8 and 16
+// seconds after the timeout. The watchdog is stopped while sleeping, as it would otherwise reset
+// the board or wake it up.
+//
+// On the host, the watchdog does nothing.
+namespace bike_tracker::watchdog {
+
+volatile uint32_t fed_at_{0};
+volatile uint32_t timeout_{0};
+
+#if defined(ARDUINO) && defined(WDT)
+void sync()
+{
+    while (WDT->STATUS.bit.SYNCBUSY);
+}
+
+void clear()
+{
+    WDT->CLEAR.reg = WDT_CLEAR_CLEAR_KEY;
+    sync();
+}
+
+extern "C" void WDT_Handler()
+{
+    WDT->INTFLAG.reg = WDT_INTFLAG_EW;
+
+    // Lets the watchdog reset the board once the timeout expired.
+    if (millis() - fed_at_ < timeout_) {
+        clear();
+    }
+}
+#endif
+
+// True if the last reset has been triggered by the watchdog.
+bool caused_reset()
+{
+#if defined(ARDUINO) && defined(WDT)
+    return PM->RCAUSE.bit.WDT;
+#else
+    return false;
+#endif
+}
+
+// The watchdog is clocked by the 1.024 kHz generic clock 2 set up by `RTCZero::begin()`, which
+// should thus be called first.
+void setup()
+{
+#if defined(ARDUINO) && defined(WDT)
+    GCLK->CLKCTRL.reg = GCLK_CLKCTRL_ID_WDT | GCLK_CLKCTRL_CLKEN | GCLK_CLKCTRL_GEN_GCLK2;
+    while (GCLK->STATUS.bit.SYNCBUSY);
+
+    WDT->CTRL.reg = 0;
+    sync();
+
+    // Period and early warning offset in cycles of the 1.024 kHz clock.
+    WDT->CONFIG.reg = WDT_CONFIG_PER_16K;
+    WDT->EWCTRL.reg = WDT_EWCTRL_EWOFFSET_8K;
+    sync();
+
+    WDT->INTFLAG.reg = WDT_INTFLAG_EW;
+    WDT->INTENSET.reg = WDT_INTENSET_EW;
+
+    NVIC_ClearPendingIRQ(WDT_IRQn);
+    NVIC_SetPriority(WDT_IRQn, 0);
+    NVIC_EnableIRQ(WDT_IRQn);
+#endif
+}
+
+// Starts the watchdog, giving the first task `timeout` ms before the board is reset.
+void start(uint32_t timeout)
+{
+    fed_at_ = millis();
+    timeout_ = timeout;
+
+#if defined(ARDUINO) && defined(WDT)
+    WDT->CTRL.reg = WDT_CTRL_ENABLE;
+    sync();
+    clear();
+#endif
+}
+
+// Gives the next task `timeout` ms before the board is reset.
+void feed(uint32_t timeout)
+{
+    fed_at_ = millis();
+    timeout_ = timeout;
+
+#if defined(ARDUINO) && defined(WDT)
+    clear();
+#endif
+}
+
+// Stops the watchdog before sleeping.
+void stop()
+{
+#if defined(ARDUINO) && defined(WDT)
+    WDT->CTRL.reg = 0;
+    sync();
+#endif
+}
+
+}